@@ -0,0 +1,369 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Accuracy-versus-cost harness.  Runs the decoder over a corpus of
+// recordings whose true time is known, and checks every decoded minute
+// against the time implied by its sample offset.
+//
+// The corpus is either synthetic (made by generator.h, which knows the true
+// time of each sample exactly, including oscillator drift and leap seconds)
+// or recorded files given as PATH@START, where START is the UTC time of the
+// first sample.
+
+#ifndef ARDUINO
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "decoder.h"
+#include "decompress.h"
+#include "generator.h"
+#include "hypotheses.h"
+#include "pipeline.h"
+
+typedef WWVBDecoder<> decoder_type;
+typedef WWVBDecoder<50, 60, 40, false, true> adaptive_decoder_type;
+typedef WWVBDecoder<50, 60, 40, false, false, true> pll_decoder_type;
+typedef WWVBDecoder<50, 60, 40, false, true, true> adaptive_pll_decoder_type;
+typedef wwvb_hypothesis_decoder<decoder_type> hypothesis_decoder_type;
+
+struct recording {
+    std::string name;
+    std::vector<uint8_t> samples;
+    // true UTC time of sample i
+    std::function<double(uint64_t)> utc_of_sample;
+};
+
+struct accuracy {
+    uint64_t samples{};
+    unsigned decoded{}, correct{}, incorrect{}, expected{};
+    double first_fix = -1; // seconds from the first sample
+    double cpu_ns{};
+
+    unsigned missed() const {
+        return expected > correct ? expected - correct : 0;
+    }
+
+    void add(const accuracy &o) {
+        samples += o.samples;
+        decoded += o.decoded;
+        correct += o.correct;
+        incorrect += o.incorrect;
+        expected += o.expected;
+        cpu_ns += o.cpu_ns;
+    }
+};
+
+static double thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// A minute is decoded at the start of its following second, which comes
+// after the nominal end of the minute by the receiver delay plus however
+// long the decoder takes to recognize the start of second.  A decode is
+// correct if it lands within this window around the minute's end.
+static constexpr double EARLY = 0.5, LATE = 1.0;
+
+// A minute which ends this close to the end of a recording can't be decoded,
+// because the start of the following second has not yet been seen
+static constexpr double TAIL = 0.2;
+
+template <class Decoder> static accuracy evaluate(const recording &rec) {
+    struct decode {
+        uint64_t sample;
+        time_t utc;
+    };
+    std::vector<decode> decodes;
+    decodes.reserve(rec.samples.size() / decoder_type::SUBSEC / 60 + 1);
+
+    Decoder dec;
+    double t0 = thread_cpu_ns();
+    for (size_t i = 0; i < rec.samples.size(); i++) {
+        wwvb_time m;
+        if (dec.update(rec.samples[i]) &&
+            dec.symbols.at(dec.SYMBOLS - 1) == 2 && dec.decode_minute(m)) {
+            decodes.push_back({i, m.to_utc()});
+        }
+    }
+    double t1 = thread_cpu_ns();
+
+    accuracy result;
+    result.samples = rec.samples.size();
+    result.cpu_ns = t1 - t0;
+    result.decoded = decodes.size();
+
+    double begin = rec.utc_of_sample(0);
+    double end = rec.utc_of_sample(rec.samples.size());
+    std::set<time_t> seen;
+    for (const auto &d : decodes) {
+        double lag = rec.utc_of_sample(d.sample) - (d.utc + 60);
+        if (lag >= -EARLY && lag <= LATE && seen.insert(d.utc).second) {
+            result.correct++;
+            if (result.first_fix < 0)
+                result.first_fix = (double)d.sample / decoder_type::SUBSEC;
+        } else {
+            result.incorrect++;
+        }
+    }
+
+    // Every minute wholly inside the recording could have been decoded
+    double first = ceil(begin / 60) * 60;
+    if (end - TAIL >= first + 60)
+        result.expected = (unsigned)floor((end - TAIL - first) / 60);
+    return result;
+}
+
+static recording synthetic(unsigned index, uint64_t seed, double hours) {
+    // Conditions cycle from clean to harsh, and the start times visit a DST
+    // change and a leap second
+    static const double noise[] = {0, .005, .02, .05, .1};
+    static const double fades[] = {0, 1, 4};
+    static const double ppm[] = {0, 150, -300};
+    static const char *starts[] = {"2021-03-13T18:00Z", "2021-07-04T00:00Z",
+                                   "2016-12-31T20:00Z", "2021-11-06T22:00Z"};
+
+    wwvb_signal_config config;
+    config.seed = seed + index;
+    config.flip_probability = noise[index % 5];
+    config.fades_per_hour = fades[index % 3];
+    config.drift_ppm = ppm[index % 3];
+    parse_utc(starts[index % 4], config.start);
+    // Start somewhere in the middle of a minute
+    config.start += 7 + index * 13 % 50;
+    if (index % 4 == 2)
+        parse_utc("2016-12-31", config.leap_second_day);
+
+    recording rec;
+    char name[96];
+    snprintf(name, sizeof(name), "synthetic-%02u noise=%.3f fades=%g ppm=%+g",
+             index, config.flip_probability, config.fades_per_hour,
+             config.drift_ppm);
+    rec.name = name;
+    wwvb_signal_generator gen(config);
+    rec.samples.resize(uint64_t(hours * 3600 * config.rate));
+    for (auto &s : rec.samples)
+        s = gen.next();
+    rec.utc_of_sample = [gen](uint64_t i) { return gen.utc_of_sample(i); };
+    return rec;
+}
+
+static bool load(const char *spec, input_format fmt, recording &rec) {
+    std::string path = spec;
+    auto at = path.rfind('@');
+    time_t start;
+    if (at == std::string::npos ||
+        !parse_utc(path.c_str() + at + 1, start)) {
+        fprintf(stderr, "%s: expected PATH@START\n", spec);
+        return false;
+    }
+    path.resize(at);
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<raw_block> blocks;
+    std::unique_ptr<raw_block> raw(new raw_block);
+    for (ssize_t n; (n = read(fd, raw->data, raw_block::SIZE)) > 0;) {
+        raw->len = n;
+        blocks.push_back(*raw);
+    }
+    close(fd);
+
+    sample_unpacker unpack(fmt);
+    auto emit = [&](const sample_block &b) {
+        for (size_t i = 0; i < b.len; i++)
+            rec.samples.push_back(b.at(i));
+    };
+    auto kind = blocks.empty() ? compression::none
+                               : detect_compression(blocks[0].data,
+                                                    blocks[0].len);
+    if (kind == compression::none) {
+        for (const auto &b : blocks)
+            unpack.feed(b, emit);
+    } else {
+        stream_decompressor inflater(kind);
+        auto feed = [&](const raw_block &b) { unpack.feed(b, emit); };
+        bool ok = true;
+        for (const auto &b : blocks)
+            ok = ok && inflater.feed(b, feed);
+        if (!ok || !inflater.finish(feed)) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), inflater.error());
+            return false;
+        }
+    }
+    unpack.finish(emit);
+
+    rec.name = spec;
+    rec.utc_of_sample = [start](uint64_t i) {
+        return start + (double)i / decoder_type::SUBSEC;
+    };
+    return true;
+}
+
+static void print_row(FILE *f, const char *name, const accuracy &a) {
+    fprintf(f, "%-44s %9.2f %7u %7u %9u %7u %9.1f %9.1f\n", name,
+            a.samples / 3600. / decoder_type::SUBSEC, a.expected, a.correct,
+            a.incorrect, a.missed(), a.first_fix,
+            a.samples ? a.cpu_ns / a.samples : 0.);
+}
+
+static void json_row(FILE *f, const char *name, const accuracy &a,
+                     bool last) {
+    fprintf(f,
+            "{\"name\":\"%s\",\"samples\":%llu,\"expected\":%u,"
+            "\"correct\":%u,\"incorrect\":%u,\"missed\":%u,"
+            "\"first_fix\":%.2f,\"ns_per_sample\":%.2f}%s\n",
+            name, (unsigned long long)a.samples, a.expected, a.correct,
+            a.incorrect, a.missed(), a.first_fix,
+            a.samples ? a.cpu_ns / a.samples : 0., last ? "" : ",");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [-g count] [-d hours] [-S seed] [-i ascii|packed]\n"
+            "          [-o report.json] [-E max_incorrect] [-A] [-P] [-H]\n"
+            "          [PATH@START...]\n"
+            "With no recordings, a synthetic corpus of count (default 12)\n"
+            "recordings of the given length (default 6 hours) is used.\n"
+            "-A uses the decoder with an adaptive history window.\n"
+            "-P uses the decoder with a phase-locked second generator.\n"
+            "-A and -P may be given together.\n"
+            "-H tracks several start of second hypotheses; it cannot be\n"
+            "combined with -A or -P.\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    unsigned count = 12;
+    double hours = 6;
+    uint64_t seed = 1;
+    long max_incorrect = -1;
+    input_format fmt = input_format::ascii;
+    const char *json = nullptr;
+    bool adaptive = false, pll = false, hypotheses = false;
+
+    for (int opt; (opt = getopt(argc, argv, "g:d:S:i:o:E:APH")) != -1;) {
+        switch (opt) {
+        case 'g':
+            count = atoi(optarg);
+            break;
+        case 'd':
+            hours = atof(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, nullptr, 0);
+            break;
+        case 'i':
+            if (!strcmp(optarg, "ascii"))
+                fmt = input_format::ascii;
+            else if (!strcmp(optarg, "packed"))
+                fmt = input_format::packed;
+            else
+                usage(argv[0]);
+            break;
+        case 'o':
+            json = optarg;
+            break;
+        case 'E':
+            max_incorrect = atol(optarg);
+            break;
+        case 'A':
+            adaptive = true;
+            break;
+        case 'P':
+            pll = true;
+            break;
+        case 'H':
+            hypotheses = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (hypotheses && (adaptive || pll))
+        usage(argv[0]);
+
+    static char zone[] = "TZ=UTC";
+    putenv(zone);
+    tzset();
+
+    printf("%-44s %9s %7s %7s %9s %7s %9s %9s\n", "recording", "hours",
+           "minutes", "correct", "incorrect", "missed", "first-fix",
+           "ns/sample");
+
+    std::vector<std::pair<std::string, accuracy>> rows;
+    accuracy total;
+    auto run = [&](const recording &rec) {
+        auto a = adaptive && pll ? evaluate<adaptive_pll_decoder_type>(rec)
+                 : adaptive      ? evaluate<adaptive_decoder_type>(rec)
+                 : pll           ? evaluate<pll_decoder_type>(rec)
+                 : hypotheses    ? evaluate<hypothesis_decoder_type>(rec)
+                                 : evaluate<decoder_type>(rec);
+        print_row(stdout, rec.name.c_str(), a);
+        rows.emplace_back(rec.name, a);
+        total.add(a);
+    };
+
+    if (optind == argc) {
+        for (unsigned i = 0; i < count; i++)
+            run(synthetic(i, seed, hours));
+    } else {
+        for (int i = optind; i < argc; i++) {
+            recording rec;
+            if (!load(argv[i], fmt, rec))
+                return 1;
+            run(rec);
+        }
+    }
+
+    // Time to first fix is summarized by the worst case
+    for (const auto &r : rows)
+        total.first_fix = std::max(total.first_fix, r.second.first_fix);
+    print_row(stdout, "total", total);
+    printf("false decode rate: %.4f%% of decoded minutes\n",
+           total.decoded ? total.incorrect * 100. / total.decoded : 0.);
+
+    if (json) {
+        FILE *f = fopen(json, "w");
+        if (!f) {
+            perror(json);
+            return 1;
+        }
+        fprintf(f, "{\"recordings\":[\n");
+        for (size_t i = 0; i < rows.size(); i++)
+            json_row(f, rows[i].first.c_str(), rows[i].second,
+                     i + 1 == rows.size());
+        fprintf(f, "],\"total\":\n");
+        json_row(f, "total", total, true);
+        fprintf(f, "}\n");
+        if (fclose(f)) {
+            perror(json);
+            return 1;
+        }
+    }
+
+    if (max_incorrect >= 0 && total.incorrect > (unsigned long)max_incorrect) {
+        fprintf(stderr, "%u incorrect minutes, more than the %ld allowed\n",
+                total.incorrect, max_incorrect);
+        return 1;
+    }
+    return 0;
+}
+#endif
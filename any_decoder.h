@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// A decoder whose sample rate is chosen at run time.  Each supported rate is
+// a fully specialized WWVBDecoder behind a virtual interface, and each
+// virtual call decodes a whole sample_block, so the per-sample loop still
+// runs with its rate as a compile-time constant.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "decoder.h"
+#include "pipeline.h"
+#include "sink.h"
+
+// The sample rates for which a decoder is compiled
+#define WWVB_ANY_DECODER_RATES(X) X(50) X(100) X(1000)
+
+struct wwvb_any_decoder {
+    typedef std::function<void(const minute_record &)> emit_type;
+
+    virtual ~wwvb_any_decoder() {}
+
+    // Decode the samples of block, calling emit for each decoded minute
+    virtual void decode(const sample_block &block, const emit_type &emit) = 0;
+
+    virtual int subsec() const = 0;
+    virtual uint64_t sample_count() const = 0;
+    virtual uint64_t symbol_count() const = 0;
+    virtual uint64_t minute_count() const = 0;
+    virtual int health() const = 0;
+    virtual int max_health() const = 0;
+    virtual const wwvb_decode_stats &decode_stats() const = 0;
+    virtual const wwvb_lock_stats &lock_stats() const = 0;
+};
+
+template <class Decoder> struct wwvb_any_decoder_impl : wwvb_any_decoder {
+    Decoder dec;
+    uint64_t symbols{}, minutes{};
+
+    void decode(const sample_block &block, const emit_type &emit) override {
+        for (size_t j = 0; j < block.len; j++) {
+            if (!dec.update(block.at(j)))
+                continue;
+            symbols++;
+            // This mark could be the minute-ending mark, so try to decode a
+            // minute
+            wwvb_time m;
+            if (dec.symbols.at(dec.SYMBOLS - 1) == 2 && dec.decode_minute(m)) {
+                minutes++;
+                emit(minute_record::make(dec, m, dec.sample_count - 1));
+            }
+        }
+    }
+
+    int subsec() const override { return dec.SUBSEC; }
+    uint64_t sample_count() const override { return dec.sample_count; }
+    uint64_t symbol_count() const override { return symbols; }
+    uint64_t minute_count() const override { return minutes; }
+    int health() const override { return dec.health; }
+    int max_health() const override { return dec.MAX_HEALTH; }
+    const wwvb_decode_stats &decode_stats() const override {
+        return dec.decode_stats;
+    }
+    const wwvb_lock_stats &lock_stats() const override { return dec.lock; }
+};
+
+// A decoder for the given rate, or nullptr if that rate is not compiled in
+inline std::unique_ptr<wwvb_any_decoder> make_any_decoder(int subsec) {
+    switch (subsec) {
+#define WWVB_ANY_DECODER_CASE(rate)                                            \
+    case rate:                                                                 \
+        return std::unique_ptr<wwvb_any_decoder>(                              \
+            new wwvb_any_decoder_impl<WWVBDecoder<rate>>);
+        WWVB_ANY_DECODER_RATES(WWVB_ANY_DECODER_CASE)
+#undef WWVB_ANY_DECODER_CASE
+    }
+    return nullptr;
+}
@@ -0,0 +1,414 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Micro- and macro-benchmarks of the decoder.  Results are printed and also
+// written as JSON (default: bench.json) so they can be compared across
+// versions.
+
+#ifndef ARDUINO
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bitslice.h"
+#include "decimator.h"
+#include "decoder.h"
+#include "generator.h"
+#include "multichannel.h"
+#include "pool.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+// Each benchmark repeats until it has run for at least this long
+static double min_seconds = 0.25;
+
+struct result {
+    std::string name;
+    int subsec;
+    const char *unit;
+    double value;
+};
+static std::vector<result> results;
+
+static void report(const std::string &name, int subsec, const char *unit,
+                   double value) {
+    printf("%-24s SUBSEC=%-5d %14.2f %s\n", name.c_str(), subsec, value,
+           unit);
+    results.push_back({name, subsec, unit, value});
+}
+
+static double now() {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Call fn(n) with growing n until it takes at least min_seconds; returns
+// seconds per unit of n
+template <class F> static double measure(F &&fn) {
+    for (size_t n = 1;; n *= 2) {
+        double t0 = now();
+        fn(n);
+        double dt = now() - t0;
+        if (dt >= min_seconds)
+            return dt / n;
+    }
+}
+
+// Ensure a computed value is not optimized away
+static volatile int sink;
+
+// A stream of whole minutes with a wandering receiver delay, starting
+// mid-second so that the decoder has to find the start of second, and
+// running on into the next minute so that the last mark is complete
+template <class Decoder> static std::vector<uint8_t> make_stream(int minutes) {
+    wwvb_signal_config config;
+    config.start = 1618315200; // 2021-04-13T12:00:00Z
+    config.rate = Decoder::SUBSEC;
+    std::vector<uint8_t> samples(Decoder::SUBSEC / 3, 0);
+    wwvb_signal_generator gen(config);
+    for (int i = 0; i < minutes * 60 * config.rate + config.rate / 2; i++)
+        samples.push_back(gen.next());
+    return samples;
+}
+
+template <class Decoder> static void bench_decoder() {
+    constexpr int SUBSEC = Decoder::SUBSEC;
+    auto stream = make_stream<Decoder>(10);
+    std::string variant = Decoder::COMPACT ? "compact_"
+                          : Decoder::PLL   ? "pll_"
+                                           : "";
+    auto name = [&](const char *n) { return variant + n; };
+
+    report(name("sizeof"), SUBSEC, "bytes", sizeof(Decoder));
+
+    {
+        Decoder dec;
+        double t = measure([&](size_t n) {
+            int seconds = 0;
+            for (size_t i = 0; i < n; i++)
+                for (auto b : stream)
+                    seconds += dec.update(b);
+            sink = seconds;
+        });
+        report(name("update"), SUBSEC, "samples/s", stream.size() / t);
+    }
+
+    {
+        Decoder dec;
+        size_t minutes = 0;
+        double t = measure([&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                for (auto b : stream) {
+                    wwvb_time m;
+                    if (dec.update(b) &&
+                        dec.symbols.at(dec.SYMBOLS - 1) == 2 &&
+                        dec.decode_minute(m)) {
+                        minutes++;
+                        sink = m.to_utc();
+                    }
+                }
+            }
+        });
+        if (!minutes) {
+            fprintf(stderr, "SUBSEC=%d: no minutes decoded\n", SUBSEC);
+            exit(1);
+        }
+        report(name("end_to_end"), SUBSEC, "samples/s", stream.size() / t);
+    }
+
+    // A decoder holding a complete, valid minute
+    Decoder dec;
+    for (auto b : stream)
+        dec.update(b);
+    wwvb_time m;
+    if (!dec.decode_minute(m)) {
+        fprintf(stderr, "SUBSEC=%d: final minute not decoded\n", SUBSEC);
+        exit(1);
+    }
+
+    {
+        Decoder d = dec;
+        double t = measure([&](size_t n) {
+            for (size_t i = 0; i < n; i++)
+                d.decode_symbol();
+            sink = d.health;
+        });
+        report(name("decode_symbol"), SUBSEC, "ns/call", t * 1e9);
+    }
+
+    {
+        double t = measure([&](size_t n) {
+            int ok = 0;
+            for (size_t i = 0; i < n; i++)
+                ok += dec.decode_minute(m);
+            sink = ok;
+        });
+        report(name("decode_minute"), SUBSEC, "ns/call", t * 1e9);
+    }
+}
+
+// Many decoders at once, as when decoding many receivers.  Each decoder
+// starts at a different phase, then all receive the same samples in
+// lockstep; the working set grows with the number of decoders.  The legacy
+// layout (without HOT_COLD) shows what ordering the fields by use is worth.
+template <class Decoder> static void bench_many(size_t count) {
+    constexpr int SUBSEC = Decoder::SUBSEC;
+    auto stream = make_stream<Decoder>(2);
+    std::vector<Decoder> decoders(count);
+    for (size_t k = 0; k < count; k++)
+        for (size_t i = 0; i < k % stream.size(); i++)
+            decoders[k].update(stream[i]);
+
+    double t = measure([&](size_t n) {
+        int seconds = 0;
+        for (size_t r = 0; r < n; r++)
+            for (auto b : stream)
+                for (auto &dec : decoders)
+                    seconds += dec.update(b);
+        sink = seconds;
+    });
+    std::string name = Decoder::COMPACT    ? "compact_many_"
+                       : Decoder::HOT_COLD ? "many_"
+                                           : "legacy_many_";
+    report(name + std::to_string(count), SUBSEC, "ns/update",
+           t * 1e9 / stream.size() / count);
+}
+
+// The bit-sliced decoder, with each of its 64 lanes receiving the stream at
+// a different phase
+template <class Decoder> static void bench_bitslice() {
+    constexpr int SUBSEC = Decoder::SUBSEC;
+    auto stream = make_stream<typename Decoder::scalar_type>(10);
+    std::vector<uint64_t> words(stream.size());
+    for (size_t i = 0; i < words.size(); i++)
+        for (int j = 0; j < Decoder::LANES; j++)
+            words[i] |= uint64_t(stream[(i + j * 7) % stream.size()]) << j;
+
+    std::unique_ptr<Decoder> dec(new Decoder);
+    double t = measure([&](size_t n) {
+        uint64_t seconds = 0;
+        for (size_t i = 0; i < n; i++)
+            for (auto w : words)
+                seconds += dec->update(w);
+        sink = seconds;
+    });
+    report("bitslice_update", SUBSEC, "ns/update", t * 1e9 / words.size());
+    report("bitslice_lane_update", SUBSEC, "ns/update",
+           t * 1e9 / words.size() / Decoder::LANES);
+}
+
+// The multichannel decoder, with each channel receiving the stream at a
+// different phase
+template <class Decoder> static void bench_multichannel() {
+    constexpr int SUBSEC = Decoder::SUBSEC;
+    constexpr size_t N = Decoder::CHANNELS, WORDS = Decoder::WORDS;
+    auto stream = make_stream<typename Decoder::scalar_type>(10);
+    std::vector<uint64_t> words(stream.size() * WORDS);
+    for (size_t i = 0; i < stream.size(); i++)
+        for (size_t j = 0; j < N; j++)
+            words[i * WORDS + j / 64] |=
+                uint64_t(stream[(i + j * 7) % stream.size()]) << (j % 64);
+
+    std::unique_ptr<Decoder> dec(new Decoder);
+    double t = measure([&](size_t n) {
+        int seconds = 0;
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < stream.size(); j++)
+                seconds += dec->update(&words[j * WORDS]);
+        sink = seconds;
+    });
+    std::string name = "multichannel_" + std::to_string(N);
+    report(name + "_update", SUBSEC, "ns/update", t * 1e9 / stream.size());
+    report(name + "_channel_update", SUBSEC, "ns/update",
+           t * 1e9 / stream.size() / N);
+}
+
+// The decoder pool, with 256 receivers spread over its shards
+static void bench_pool(unsigned shards) {
+    constexpr int RECEIVERS = 256;
+    auto stream = make_stream<WWVBDecoder<>>(2);
+    std::vector<sample_block> blocks;
+    for (size_t i = 0; i < stream.size();) {
+        sample_block b{};
+        for (; b.len < b.SIZE && i < stream.size(); b.len++, i++)
+            b.bits[b.len / 64] |= uint64_t(stream[i]) << (b.len % 64);
+        blocks.push_back(b);
+    }
+
+    double t = measure([&](size_t n) {
+        std::unique_ptr<wwvb_decoder_pool<>> pool(
+            new wwvb_decoder_pool<>(shards));
+        size_t minutes = 0;
+        std::thread consumer([&] {
+            wwvb_pool_record r;
+            while (pool->pop(r))
+                minutes++;
+        });
+        for (int k = 0; k < RECEIVERS; k++)
+            pool->add(k);
+        for (size_t i = 0; i < n; i++)
+            for (const auto &b : blocks)
+                for (int k = 0; k < RECEIVERS; k++)
+                    pool->submit(k, b);
+        pool->close();
+        consumer.join();
+        sink = minutes;
+    });
+    report("pool_" + std::to_string(shards), 50, "samples/s",
+           stream.size() * RECEIVERS / t);
+}
+
+// Filtering 1kHz samples down to 50Hz, against doing the same a sample at a
+// time
+static void bench_decimator() {
+    constexpr int FACTOR = 20;
+    wwvb_signal_config config;
+    config.start = 1618315200;
+    config.rate = 50 * FACTOR;
+    config.flip_probability = .05;
+    wwvb_signal_generator gen(config);
+    std::vector<sample_block> blocks(64);
+    for (auto &b : blocks) {
+        b = {};
+        for (; b.len < b.SIZE; b.len++)
+            b.bits[b.len / 64] |= uint64_t(gen.next()) << (b.len % 64);
+    }
+    size_t outputs = blocks.size() * sample_block::SIZE / FACTOR;
+
+    double t = measure([&](size_t n) {
+        std::unique_ptr<wwvb_decimator> dec(new wwvb_decimator(FACTOR));
+        int ones = 0;
+        auto emit = [&](const sample_block &b) { ones += b.bits[0] & 1; };
+        for (size_t i = 0; i < n; i++)
+            for (const auto &b : blocks)
+                dec->feed(b, emit);
+        sink = ones;
+    });
+    report("decimate", 50, "ns/output", t * 1e9 / outputs);
+
+    t = measure([&](size_t n) {
+        int ones = 0;
+        for (size_t i = 0; i < n; i++) {
+            bool l = false, last = false;
+            int count = 0, k = 0;
+            for (const auto &b : blocks) {
+                for (size_t j = 0; j < b.len; j++) {
+                    bool m = b.at(j);
+                    bool r = j + 1 < b.len ? b.at(j + 1) : m;
+                    count += (l + m + r) >= 2;
+                    l = m;
+                    if (++k == FACTOR) {
+                        if (count * 2 != FACTOR)
+                            last = count * 2 > FACTOR;
+                        ones += last;
+                        count = k = 0;
+                    }
+                }
+            }
+        }
+        sink = ones;
+    });
+    report("decimate_scalar", 50, "ns/output", t * 1e9 / outputs);
+}
+
+static void bench_time() {
+    wwvb_time w = {.yday = 311, .year = 21, .hour = 6, .minute = 30, .dst = 1};
+
+    double t = measure([&](size_t n) {
+        time_t sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            w.minute = i % 60;
+            sum += w.to_utc();
+        }
+        sink = sum;
+    });
+    report("to_utc", 0, "ns/call", t * 1e9);
+
+    t = measure([&](size_t n) {
+        int sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            w.minute = i % 60;
+            sum += w.apply_zone_and_dst(6, true).tm_hour;
+        }
+        sink = sum;
+    });
+    report("apply_zone_and_dst", 0, "ns/call", t * 1e9);
+}
+
+static bool write_json(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fprintf(f, "{\"version\":\"%s\",\"results\":[", BENCH_VERSION);
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        fprintf(f,
+                "%s\n{\"name\":\"%s\",\"subsec\":%d,\"unit\":\"%s\","
+                "\"value\":%.3f}",
+                i ? "," : "", r.name.c_str(), r.subsec, r.unit, r.value);
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv) {
+    const char *output = "bench.json";
+    for (int opt; (opt = getopt(argc, argv, "o:t:")) != -1;) {
+        switch (opt) {
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            min_seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-o output.json] [-t min_seconds]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    static char zone[] = "TZ=UTC";
+    putenv(zone);
+    tzset();
+
+    bench_decoder<WWVBDecoder<50>>();
+    bench_decoder<WWVBDecoder<100>>();
+    bench_decoder<WWVBDecoder<1000>>();
+    bench_decoder<WWVBDecoder<50, 60, 40, true>>();
+    bench_decoder<WWVBDecoder<100, 60, 40, true>>();
+    bench_decoder<WWVBDecoder<1000, 60, 40, true>>();
+    bench_decoder<WWVBDecoder<50, 60, 40, false, false, true>>();
+    bench_decoder<WWVBDecoder<1000, 60, 40, false, false, true>>();
+    bench_bitslice<BitslicedWWVBDecoder<50>>();
+    bench_bitslice<BitslicedWWVBDecoder<100>>();
+    bench_bitslice<BitslicedWWVBDecoder<1000>>();
+    bench_multichannel<MultichannelWWVBDecoder<64, 50>>();
+    bench_multichannel<MultichannelWWVBDecoder<64, 100>>();
+    bench_multichannel<MultichannelWWVBDecoder<64, 1000>>();
+    bench_multichannel<MultichannelWWVBDecoder<256, 50>>();
+    for (size_t count : {1, 64, 1024, 8192}) {
+        bench_many<WWVBDecoder<50>>(count);
+        bench_many<WWVBDecoder<50, 60, 40, false, false, false, false>>(count);
+        bench_many<WWVBDecoder<50, 60, 40, true>>(count);
+    }
+    bench_decimator();
+    for (unsigned shards : {1, 2, 4})
+        bench_pool(shards);
+    bench_time();
+
+    return !write_json(output);
+}
+#endif
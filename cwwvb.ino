@@ -8,14 +8,24 @@
 #include <algorithm>
 #include <atomic>
 
+// CWWVB_SIM builds the firmware for the host; see firmware_sim.cpp
+#ifdef CWWVB_SIM
+#include "hal_sim.h"
+#else
 #include "SAMDTimerInterrupt.h"
 #include "SAMD_ISR_Timer.h"
-
-#include "decoder.h"
+#endif
 
 #define MONITOR_LL (0)
 #define MONITOR_SYM (0)
 
+// Set to 1 to count cycles spent in each stage of decoding; press 'p' to
+// print the counts and 'r' to reset them
+// #define WWVB_INSTRUMENT (1)
+
+#include "decoder.h"
+#include "snapshot.h"
+
 #define AUTO_STEERING (1)
 
 // SAMD51 Hardware Timer only TC3
@@ -29,6 +39,9 @@ int cc;
 int tick_subsec;
 
 WWVBDecoder<> dec;
+typedef wwvb_decoder_snapshot<decltype(dec)> snapshot_type;
+// What the interrupt publishes for try_decode each second
+wwvb_seqlock<snapshot_type> published;
 constexpr int CENTRAL_COUNT = 3000000 / dec.SUBSEC;
 static_assert(CENTRAL_COUNT <= 65535);
 
@@ -72,7 +85,10 @@ static void try_decode();
 std::atomic<int> introduced_error;
 
 void TimerHandler0(void) {
+    WWVB_STAGE_BEGIN(isr);
     int i = digitalRead(PIN_OUT);
+    // A pulse on PIN_MON at each sample, for a scope or logic analyzer to
+    // trigger on when checking the sampling against PIN_OUT
     digitalWrite(PIN_MON, HIGH);
     digitalWrite(PIN_MON, LOW);
     TC3->COUNT16.CC[0].reg = cc;
@@ -81,9 +97,12 @@ void TimerHandler0(void) {
 #endif
     if (introduced_error.load()) {
         introduced_error.fetch_sub(1);
+        WWVB_STAGE_END(isr);
         return;
     }
     if (dec.update(i)) {
+        published.next().capture(dec);
+        published.commit();
         wq.put(try_decode);
     }
 
@@ -91,6 +110,7 @@ void TimerHandler0(void) {
     if (subsec == 0) {
         wq.put(tick);
     }
+    WWVB_STAGE_END(isr);
 }
 
 void moveto(int x, int y) { printf("\033[%d;%dH", y, x); }
@@ -139,6 +159,21 @@ void loop() {
         if (c == 'x') {
             introduced_error.fetch_add(5);
         }
+#if WWVB_INSTRUMENT
+        if (c == 'p') {
+            wwvb_stage_stats profile[WWVB_STAGE_COUNT];
+            {
+                Critical _;
+                memcpy(profile, wwvb_stage_profile, sizeof(profile));
+            }
+            moveto(1, 27);
+            wwvb_profile_print(stdout, profile);
+        }
+        if (c == 'r') {
+            Critical _;
+            wwvb_profile_reset();
+        }
+#endif
 #if !AUTO_STEERING
         if (c == '+' || c == '=') {
             steer_tc(1);
@@ -168,18 +203,16 @@ void loop() {
 }
 
 void try_decode() {
-    decltype(dec) snapshot;
-    {
-        Critical _;
-        snapshot = dec;
-    }
+    WWVB_STAGE_BEGIN(try_decode);
+    snapshot_type snapshot;
+    published.read(snapshot);
 
 #if AUTO_STEERING
     // Try to steer the start-of-subsec to the "0" value
     // This is a simple PI control, which should
     // settle with almost no phase error. (or, more likely, oscillate
     // around two nearby values)
-    bool hold = snapshot.health < snapshot.HEALTH_97PCT;
+    bool hold = snapshot.health < int(snapshot.HEALTH_97PCT);
     ss_P = mod_diff<snapshot.SUBSEC>(snapshot.sos, 0);
     if (!hold) {
         ss_I += ss_P;
@@ -194,16 +227,16 @@ void try_decode() {
 
         int max_counts = 0;
         int max_edges = 0;
-        for (int i = 0; i < snapshot.SUBSEC; i++) {
+        for (int i = 0; i < int(snapshot.SUBSEC); i++) {
             max_counts = std::max(max_counts, (int)snapshot.counts[i]);
             max_edges = std::max(max_edges, (int)abs(snapshot.edges[i]));
         }
         for (int i = 0; i < ROWS; i++) {
             screen[i][snapshot.sos] = '.';
         }
-        for (int i = 0; i < snapshot.SUBSEC; i++) {
+        for (int i = 0; i < int(snapshot.SUBSEC); i++) {
             int j = i;
-            while (j >= snapshot.SUBSEC)
+            while (j >= int(snapshot.SUBSEC))
                 j -= snapshot.SUBSEC;
 
             {
@@ -222,23 +255,43 @@ void try_decode() {
 
         moveto(1, 2);
         for (int i = 0; i < ROWS; i++) {
-            printf("%.*s|\n", snapshot.SUBSEC, screen[i]);
+            printf("%.*s|\n", int(snapshot.SUBSEC), screen[i]);
         }
     }
 
     {
         char buf[snapshot.SYMBOLS];
-        for (int i = 0; i < sizeof(buf); i++) {
+        for (int i = 0; i < int(sizeof(buf)); i++) {
             static const char sym2char[] = "012?";
             buf[i] = sym2char[snapshot.symbols.at(i)];
         }
+        // The start of second in tenths of a millisecond
+        int sos_tenths = snapshot.sos_q8() * 10000 / (256 * snapshot.SUBSEC);
         moveto(1, 25);
-        printf("%.*s health=%3d%%", sizeof(buf), buf,
-               snapshot.health * 100 / snapshot.MAX_HEALTH);
+        printf("%.*s health=%3d%% quality=%3d%% sharpness=%3d%% "
+               "sos=%3d.%dms",
+               int(sizeof(buf)), buf,
+               snapshot.health * 100 / int(snapshot.MAX_HEALTH),
+               snapshot.quality_pct(), snapshot.sharpness_pct(),
+               sos_tenths / 10, sos_tenths % 10);
     }
 
     if (snapshot.symbols.at(snapshot.SYMBOLS - 1) == 2) {
-        if (snapshot.decode_minute(w)) {
+        // The interrupt never touches decode_stats, so it can be used
+        // without a critical section
+        bool ok = snapshot.decode_minute(w, dec.decode_stats);
+        const auto &st = dec.decode_stats;
+        moveto(1, 26);
+        printf("minutes=%lu failed=%lu last=%s@%d locks=%lu losses=%lu\033[K",
+               (unsigned long)st.count[st.ok], (unsigned long)st.failures(),
+               st.name(st.last_reason), st.last_symbol,
+               (unsigned long)snapshot.acquisitions,
+               (unsigned long)snapshot.holdovers);
+        if (ok) {
+            {
+                Critical _;
+                dec.track_valid_minute(snapshot.sample_count, snapshot.health);
+            }
             tick_subsec = mod_diff<snapshot.SUBSEC>(snapshot.sos, 5);
             // Must advance by seconds instead of by a minute, because
             // if this just-received minute has a leap second,
@@ -250,6 +303,7 @@ void try_decode() {
             display_time();
         }
     }
+    WWVB_STAGE_END(try_decode);
 }
 
 void tick() {
@@ -259,8 +313,13 @@ void tick() {
     //}
 }
 
+#ifndef CWWVB_SIM
 extern "C" int write(int file, char *ptr, int len);
+#endif
 void setup() {
+#if WWVB_INSTRUMENT
+    wwvb_instrument_init();
+#endif
     pinMode(PIN_PDN, OUTPUT);
     pinMode(PIN_MON, OUTPUT);
     pinMode(PIN_LED, OUTPUT);
@@ -283,6 +342,7 @@ void setup() {
     printf("\033[2J");
 }
 
+#ifndef CWWVB_SIM
 // This bridges from stdio output to Serial.write
 #include <errno.h>
 #undef errno
@@ -323,3 +383,4 @@ int _write(int file, char *ptr, int len) {
 
 extern "C" int write(int file, char *ptr, int len);
 int write(int file, char *ptr, int len) __attribute__((alias("_write")));
+#endif
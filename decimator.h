@@ -0,0 +1,133 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// A front end for receiver output sampled faster than the decoder's rate.
+// Glitches shorter than a sample are first removed by a median-of-3 filter,
+// then each group of `factor` samples becomes one output sample by majority
+// vote, so a glitch must fill half a decoder sample to get through.  Both
+// steps work on 64 samples at a time: the median is three bitwise operations
+// on shifted copies of a word, and each vote is a popcount.
+
+#pragma once
+
+#include <cstdint>
+
+#include "pipeline.h"
+
+struct wwvb_decimator {
+    // factor input samples make each output sample; 1 to 64
+    explicit wwvb_decimator(int factor) : factor(factor) { out.len = 0; }
+
+    // Calls emit(const sample_block &) for every output block that fills up
+    template <class F> void feed(const sample_block &in, F &&emit) {
+        for (size_t i = 0; i < in.len; i += 64) {
+            size_t n = in.len - i < 64 ? in.len - i : 64;
+            push(in.bits[i / 64], n, emit);
+        }
+    }
+
+    // Filters the remaining samples and emits the final, partial block.  A
+    // final partial group is dropped.
+    template <class F> void finish(F &&emit) {
+        if (have_pending) {
+            // The samples past the end repeat the last one
+            uint64_t last = cur_len ? cur >> (cur_len - 1) & 1 : pending >> 63;
+            uint64_t next = cur_len ? cur | (-last << cur_len) : -last;
+            vote(median(pending, next), 64, emit);
+            prev = pending;
+            have_pending = false;
+        }
+        if (cur_len) {
+            uint64_t last = cur >> (cur_len - 1) & 1;
+            vote(median(cur | (-last << cur_len), -last), cur_len, emit);
+            cur_len = 0;
+        }
+        if (out.len)
+            emit(out);
+        out.len = 0;
+        cur = rem = 0;
+    }
+
+    // The median of each sample and its neighbours, given the following word
+    uint64_t median(uint64_t x, uint64_t next) const {
+        uint64_t left = x << 1 | prev >> 63;
+        uint64_t right = x >> 1 | next << 63;
+        return (left & x) | (left & right) | (x & right);
+    }
+
+  private:
+    // Gathers input into whole words; each is filtered once the word after
+    // it has arrived
+    template <class F> void push(uint64_t bits, size_t n, F &&emit) {
+        if (n < 64)
+            bits &= (uint64_t{1} << n) - 1;
+        uint64_t word;
+        if (cur_len + n < 64) {
+            cur |= bits << cur_len;
+            cur_len += n;
+            return;
+        }
+        word = cur | bits << cur_len;
+        size_t used = 64 - cur_len;
+        cur = used < 64 ? bits >> used : 0;
+        cur_len = n - used;
+
+        if (have_pending) {
+            vote(median(pending, word), 64, emit);
+            prev = pending;
+        }
+        pending = word;
+        have_pending = true;
+    }
+
+    // Votes on the groups within the first n filtered samples of f
+    template <class F> void vote(uint64_t f, int n, F &&emit) {
+        int i = 0;
+        if (rem) {
+            int need = factor - rem;
+            if (need > n) {
+                carry |= (n < 64 ? f & ((uint64_t{1} << n) - 1) : f) << rem;
+                rem += n;
+                return;
+            }
+            uint64_t mask = need < 64 ? (uint64_t{1} << need) - 1 : ~uint64_t{};
+            put(__builtin_popcountll(carry) + __builtin_popcountll(f & mask),
+                emit);
+            i = need;
+        }
+        uint64_t mask =
+            factor < 64 ? (uint64_t{1} << factor) - 1 : ~uint64_t{};
+        for (; i + factor <= n; i += factor)
+            put(__builtin_popcountll(f >> i & mask), emit);
+        rem = n - i;
+        carry = rem ? f >> i & ((uint64_t{1} << rem) - 1) : 0;
+    }
+
+    // A tie keeps the previous output
+    template <class F> void put(int count, F &&emit) {
+        if (count * 2 != factor)
+            last_out = count * 2 > factor;
+        size_t w = out.len / 64, b = out.len % 64;
+        if (b == 0)
+            out.bits[w] = 0;
+        out.bits[w] |= uint64_t(last_out) << b;
+        if (++out.len == sample_block::SIZE) {
+            emit(out);
+            out.len = 0;
+        }
+    }
+
+    int factor;
+    // Input not yet making a whole word
+    uint64_t cur{};
+    size_t cur_len{};
+    // The latest whole word, and the one before it
+    uint64_t pending{}, prev{};
+    bool have_pending{};
+    // Filtered samples not yet making a whole group
+    uint64_t carry{};
+    int rem{};
+    bool last_out{};
+    sample_block out;
+};
@@ -2,7 +2,7 @@
 //
 // SPDX-License-Identifier: GPL-3.0-only
 
-#ifndef MAIN
+#if !defined(MAIN) && !defined(NDEBUG)
 #define NDEBUG
 #endif
 
@@ -136,56 +136,264 @@ void wwvb_time::advance_minutes(int n) {
     ly = isly(year);
 }
 
+bool wwvb_time::operator==(const wwvb_time &other) const {
+    return yday == other.yday && year == other.year && hour == other.hour &&
+           minute == other.minute && second == other.second &&
+           ls == other.ls && ly == other.ly && dst == other.dst &&
+           dut1 == other.dut1;
+}
+
 #if MAIN
-#include <iostream>
+#include <cstdlib>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+#include "any_decoder.h"
+#include "decimator.h"
+#include "decompress.h"
+#include "pipeline.h"
+#include "sink.h"
 using namespace std;
 
-int main() {
-    WWVBDecoder<> dec;
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [-i ascii|packed] [-f text|csv|jsonl|binary] "
+            "[-o output] [-r rate] [-O factor] [-L] [input]\n"
+            "rate is the samples per second: one of"
+#define WWVB_RATE_NAME(rate) " " #rate
+            WWVB_ANY_DECODER_RATES(WWVB_RATE_NAME) " (default 50)\n"
+#undef WWVB_RATE_NAME
+            "With -O, the input has factor (1 to 64) times as many samples\n"
+            "per second, and is filtered down to the rate.\n",
+            argv0);
+    exit(2);
+}
+
+// Time to each milestone of acquisition, and the distributions of the
+// durations of acquisition and of lock
+template <class Report>
+static void report_lock(Report &report, const wwvb_any_decoder &dec) {
+    const auto &l = dec.lock_stats();
+    auto seconds = [&](uint64_t sample) {
+        return sample ? (double)sample / dec.subsec() : -1.;
+    };
+    report("Lock: stable SoS %.1fs, valid symbols %.1fs, valid minute %.1fs, "
+           "locked %.1fs (-1: never)\n",
+           seconds(l.first_stable_sos), seconds(l.first_valid_symbols),
+           seconds(l.first_valid_minute), seconds(l.first_lock));
+    auto histogram = [&](const char *name, const wwvb_stage_stats &s) {
+        report("%-12s %6u  min %6us  mean %6us  max %6us\n", name,
+               (unsigned)s.count, (unsigned)s.min, (unsigned)s.mean(),
+               (unsigned)s.max);
+        for (int b = 0; b < s.BUCKETS; b++) {
+            if (s.histogram[b])
+                report("    < %6lus %6u\n", 1ul << b,
+                       (unsigned)s.histogram[b]);
+        }
+    };
+    histogram("Acquisitions", l.acquisition);
+    histogram("Holdovers", l.holdover);
+    if (l.locked())
+        report("Locked for %.1fs at end of input\n",
+               (double)(dec.sample_count() - l.locked_since) / dec.subsec());
+}
+
+int main(int argc, char **argv) {
+    int rate = 50, oversample = 1;
+    input_format in_fmt = input_format::ascii;
+    output_format fmt = output_format::text;
+    int in_fd = 0, out_fd = 1;
+    bool show_lock = false;
+
+    for (int opt; (opt = getopt(argc, argv, "i:f:o:r:O:L")) != -1;) {
+        switch (opt) {
+        case 'i':
+            if (!strcmp(optarg, "ascii"))
+                in_fmt = input_format::ascii;
+            else if (!strcmp(optarg, "packed"))
+                in_fmt = input_format::packed;
+            else
+                usage(argv[0]);
+            break;
+        case 'f':
+            if (!parse_output_format(optarg, fmt))
+                usage(argv[0]);
+            break;
+        case 'L':
+            show_lock = true;
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'O':
+            oversample = atoi(optarg);
+            if (oversample < 1 || oversample > 64)
+                usage(argv[0]);
+            break;
+        case 'o':
+            out_fd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (out_fd < 0) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    // The rate is dispatched once, here; each call decodes a whole block
+    auto dec = make_any_decoder(rate);
+    if (!dec || optind + 1 < argc)
+        usage(argv[0]);
+    if (optind < argc) {
+        in_fd = open(argv[optind], O_RDONLY);
+        if (in_fd < 0) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
 
     static char zone[] = "TZ=UTC";
     putenv(zone);
     tzset();
 
-    int i = 0, si = 0, d = 0;
-    for (int c; (c = cin.get()) != EOF;) {
-        if (c != '_' && c != '#') {
+    // Read the first block here, to detect compressed input
+    unique_ptr<raw_block> first(new raw_block);
+    first->len = 0;
+    while (first->len < raw_block::SIZE) {
+        ssize_t n = read(in_fd, first->data + first->len,
+                         raw_block::SIZE - first->len);
+        if (n < 0 && errno == EINTR)
             continue;
+        if (n < 0) {
+            perror("read");
+            return 1;
         }
-        if (dec.update(c == '_')) {
-            si++;
-            auto sym = dec.symbols.at(dec.SYMBOLS - 1);
-            // std::cout << sym;
-            // if(si % 60 == 0) std::cout << "\n";
-            if (sym == 2) {
-                // This mark could be the minute-ending mark, so try to
-                // decode a minute
-                wwvb_time m;
-                if (dec.decode_minute(m)) {
-                    d++;
-                    time_t t = m.to_utc();
-                    struct tm tt;
-                    gmtime_r(&t, &tt);
-                    printf("[%7.2f] %4d-%02d-%02d %2d:%02d %d %d\n", i / 50.,
-                           1900 + tt.tm_year, tt.tm_mon + 1, tt.tm_mday,
-                           tt.tm_hour, tt.tm_min, m.ly, m.dst);
-                    tt = m.apply_zone_and_dst(6, true);
-                    printf("          %4d-%02d-%02d %2d:%02d\n",
-                           1900 + tt.tm_year, tt.tm_mon + 1, tt.tm_mday,
-                           tt.tm_hour, tt.tm_min);
-                    printf("          %4d-%03d   %2d:%02d\n", m.year + 2000,
-                           m.yday, m.hour, m.minute);
-                    printf("Health %4d / %d (%5.2f%%)\n", dec.health,
-                           (int)dec.MAX_HEALTH,
-                           dec.health * 100. / dec.MAX_HEALTH);
-                }
+        if (n == 0)
+            break;
+        first->len += n;
+    }
+    auto kind = detect_compression(first->data, first->len);
+
+    auto read_ring = make_ring<raw_block, 8>();
+    auto inflated_ring = make_ring<raw_block, 8>();
+    auto sample_ring = make_ring<sample_block, 16>();
+    auto record_ring = make_ring<minute_record, 1024>();
+    // Uncompressed input goes straight from the reader to the unpacker
+    auto raw_ring = kind == compression::none ? read_ring.get()
+                                              : inflated_ring.get();
+    atomic<bool> input_failed{};
+
+    thread reader([&] {
+        read_ring->push(*first);
+        unique_ptr<raw_block> raw(new raw_block);
+        ssize_t n;
+        // A short first block means the input has already ended
+        while (first->len == raw_block::SIZE &&
+               (n = read(in_fd, raw->data, raw_block::SIZE)) != 0) {
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("read");
+                input_failed = true;
+                break;
             }
+            raw->len = n;
+            read_ring->push(*raw);
         }
-        i++;
+        read_ring->close();
+    });
+
+    thread decompressor;
+    if (kind != compression::none) {
+        decompressor = thread([&] {
+            stream_decompressor inflater(kind);
+            unique_ptr<raw_block> raw(new raw_block);
+            auto emit = [&](const raw_block &b) { inflated_ring->push(b); };
+            bool ok = true;
+            while (ok && read_ring->pop(*raw))
+                ok = inflater.feed(*raw, emit);
+            // Drain the reader, so it is not left blocked on a full ring
+            while (read_ring->pop(*raw)) {
+            }
+            if (ok)
+                ok = inflater.finish(emit);
+            if (!ok) {
+                fprintf(stderr, "decompression: %s\n", inflater.error());
+                input_failed = true;
+            }
+            inflated_ring->close();
+        });
     }
-    printf(
-        "Samples: %8d Symbols: %7d Minutes: %6d Health: %4d / %d (%5.2f%%)\n",
-        i, si, d, dec.health, (int)dec.MAX_HEALTH,
-        dec.health * 100. / dec.MAX_HEALTH);
+
+    thread unpacker([&] {
+        sample_unpacker unpack(in_fmt);
+        unique_ptr<raw_block> raw(new raw_block);
+        auto push = [&](const sample_block &b) { sample_ring->push(b); };
+        if (oversample == 1) {
+            while (raw_ring->pop(*raw))
+                unpack.feed(*raw, push);
+            unpack.finish(push);
+        } else {
+            unique_ptr<wwvb_decimator> decimate(new wwvb_decimator(oversample));
+            auto emit = [&](const sample_block &b) { decimate->feed(b, push); };
+            while (raw_ring->pop(*raw))
+                unpack.feed(*raw, emit);
+            unpack.finish(emit);
+            decimate->finish(push);
+        }
+        sample_ring->close();
+    });
+
+    buffered_writer out(out_fd);
+    output_sink sink(out, fmt);
+    sink.begin();
+
+    thread formatter([&] {
+        minute_record r;
+        while (record_ring->pop(r))
+            sink.minute(r);
+    });
+
+    sample_block block;
+    wwvb_any_decoder::emit_type emit = [&](const minute_record &r) {
+        record_ring->push(r);
+    };
+    while (sample_ring->pop(block))
+        dec->decode(block, emit);
+    record_ring->close();
+
+    reader.join();
+    if (decompressor.joinable())
+        decompressor.join();
+    unpacker.join();
+    formatter.join();
+
+    // The structured formats keep their stream pure and report the totals
+    // on stderr instead
+    auto report = [&](const char *format, auto... args) {
+        if (fmt == output_format::text)
+            out.printf(format, args...);
+        else
+            fprintf(stderr, format, args...);
+    };
+    report("Samples: %8zu Symbols: %7zu Minutes: %6zu Health: %4d / %d "
+           "(%5.2f%%)\n",
+           (size_t)dec->sample_count(), (size_t)dec->symbol_count(),
+           (size_t)dec->minute_count(), dec->health(), dec->max_health(),
+           dec->health() * 100. / dec->max_health());
+    const auto &st = dec->decode_stats();
+    if (st.failures())
+        report("Failed minutes: %6u (mark %u, zero %u, bcd %u, dut1_sign %u)\n",
+               st.failures(), st.count[st.mark], st.count[st.zero],
+               st.count[st.bcd], st.count[st.dut1_sign]);
+    if (show_lock)
+        report_lock(report, *dec);
+    out.flush();
+#if WWVB_INSTRUMENT
+    wwvb_profile_print(stderr);
+#endif
+    return out.failed() || input_failed;
 }
 #endif
@@ -10,6 +10,9 @@
 #include <cstdint>
 #include <cstdio>
 #include <ctime>
+#include <type_traits>
+
+#include "instrument.h"
 
 template <int N> int mod_diff(int a, int b) {
     int c = a - b;
@@ -31,7 +34,7 @@ template <int N> struct circular_bit_array {
     bool at(int i) const {
         assert(i >= 0 && i < N);
         i += shift;
-        if (i > N)
+        if (i >= N)
             i -= N;
         int j = i % 32;
         i /= 32;
@@ -100,45 +103,510 @@ struct wwvb_time {
     bool operator==(const wwvb_time &other) const;
 };
 
-template <size_t SUBSEC_ = 50, size_t SYMBOLS_ = 60, size_t HISTORY_ = 40>
-struct WWVBDecoder {
-    // The second is divided into units of SUBSEC
-    static constexpr size_t SUBSEC = SUBSEC_;
+// Why decode_minute did or did not succeed.  Each attempt that begins and
+// ends with a mark is counted under the first problem found, and the latest
+// failure is kept along with the position (0..59) of the offending symbol
+// within the minute: a misplaced mark suggests a timing slip, while the
+// other reasons suggest a misread symbol.
+struct wwvb_decode_stats {
+    enum reason : uint8_t { ok, mark, zero, bcd, dut1_sign, REASONS };
+
+    uint32_t count[REASONS]{};
+    reason last_reason{ok};
+    int8_t last_symbol{-1};
+
+    bool pass() {
+        count[ok]++;
+        return true;
+    }
 
-    // This many WWVB symbols are accumulated
-    static constexpr size_t SYMBOLS = SYMBOLS_;
+    bool fail(reason r, int symbol) {
+        count[r]++;
+        last_reason = r;
+        last_symbol = symbol;
+        return false;
+    }
 
-    // This many whole seconds of symbols are accumulated for statistics.
-    // 5 seconds is too little history, 60 is plenty.  40 seems okay.
+    uint32_t failures() const {
+        uint32_t result = 0;
+        for (int i = mark; i < REASONS; i++)
+            result += count[i];
+        return result;
+    }
+
+    static const char *name(reason r) {
+        static const char *const names[] = {"ok", "mark", "zero", "bcd",
+                                            "dut1_sign"};
+        return names[r];
+    }
+};
+
+// Stands in for wwvb_decode_stats in the compact decoder
+struct wwvb_no_decode_stats {
+    bool pass() { return true; }
+    bool fail(wwvb_decode_stats::reason, int) { return false; }
+};
+
+// Indicators of signal quality, from the statistics of the raw samples.
+// The sums are relative to the start of second as of the most recent
+// second, and are kept up to date on every sample; peak and runner_up are
+// found once per second.
+struct wwvb_signal_quality {
+    // Sum of the positive edges, and of those within 2 buckets of the
+    // start-of-second edge.  Noise adds positive edges elsewhere.
+    int32_t edge_energy, near_energy;
+    // The near edges weighted by their offset in buckets from the
+    // start-of-second edge; see sos_q8()
+    int32_t near_moment;
+    // Reduced-carrier samples in the first 200ms of the second (always
+    // reduced) and the last 200ms (never reduced)
+    int32_t count_a, count_d;
+    // The sharpest edge, and the sharpest more than 2 buckets from it
+    int16_t peak, runner_up;
+};
+
+// Acquisition and loss of lock.  An acquisition begins at power-up or when
+// lock is lost, passes the milestones of a stable start of second, a run of
+// good symbols and a valid minute, and ends in lock once a valid minute is
+// decoded with healthy symbols.  Lock is lost when health drops below 97%.
+// Times are in samples; 0 means not yet.
+struct wwvb_lock_stats {
+    // Milestones of the first acquisition after power-up
+    uint64_t first_stable_sos, first_valid_symbols, first_valid_minute,
+        first_lock;
+    // The start of the current acquisition, and the start of the current
+    // lock (0 when not locked)
+    uint64_t acquiring_since, locked_since;
+    // Durations in seconds of each acquisition and each period of lock
+    wwvb_stage_stats acquisition, holdover;
+
+    // Consecutive seconds with a steady start of second, and consecutive
+    // good symbols
+    uint8_t stable_seconds, valid_symbols;
+    uint16_t last_sos;
+
+    // Milestones of acquisition: the start of second staying within a
+    // bucket for this many seconds, and this many consecutive good symbols
+    static constexpr int STABLE_SECONDS = 10, VALID_SYMBOLS = 10;
+
+    bool locked() const { return locked_since != 0; }
+
+    // At the end of each second
+    void second(uint64_t sample, int subsec, int sos, bool good_symbol,
+                bool healthy) {
+        int d = sos - last_sos;
+        if (d > subsec / 2)
+            d -= subsec;
+        if (d < -subsec / 2)
+            d += subsec;
+        last_sos = sos;
+        if (d < -1 || d > 1)
+            stable_seconds = 0;
+        else if (stable_seconds < 255)
+            stable_seconds++;
+        if (!good_symbol)
+            valid_symbols = 0;
+        else if (valid_symbols < 255)
+            valid_symbols++;
+
+        if (locked()) {
+            if (!healthy) {
+                holdover.record((sample - locked_since) / subsec);
+                locked_since = 0;
+                acquiring_since = sample;
+            }
+            return;
+        }
+        if (!first_stable_sos && stable_seconds >= STABLE_SECONDS)
+            first_stable_sos = sample;
+        if (!first_valid_symbols && valid_symbols >= VALID_SYMBOLS)
+            first_valid_symbols = sample;
+    }
+
+    // For each valid minute
+    void valid_minute(uint64_t sample, int subsec, bool healthy) {
+        if (!first_valid_minute)
+            first_valid_minute = sample;
+        if (locked() || !healthy)
+            return;
+        acquisition.record((sample - acquiring_since) / subsec);
+        locked_since = sample;
+        if (!first_lock)
+            first_lock = sample;
+    }
+};
+
+// Stands in for wwvb_lock_stats in the compact decoder
+struct wwvb_no_lock_stats {
+    bool locked() const { return false; }
+    void second(uint64_t, int, int, bool, bool) {}
+    void valid_minute(uint64_t, int, bool) {}
+};
+
+// Exchange the health of the oldest symbol for that of the newest
+template <class T, size_t N>
+int exchange_health(std::array<T, N> &history, size_t i, int h) {
+    int result = history[i];
+    history[i] = h;
+    return result;
+}
+
+template <int N, int M>
+int exchange_health(circular_symbol_array<N, M> &history, size_t, int h) {
+    return history.put(h);
+}
+
+// The number of bits needed for values 0..n
+constexpr int bits_for(size_t n) { return n ? 1 + bits_for(n / 2) : 0; }
+
+// Decodes the fields of a minute, given sym(i) which returns the i'th symbol
+// (0..59) of the minute, in any decoder's symbol storage
+template <class Symbols> struct wwvb_minute_decoder {
+    explicit wwvb_minute_decoder(const Symbols &sym) : sym(sym) {}
+
+    const Symbols &sym;
+
+    // Set when a BCD digit exceeds 9; bcderr_symbol is the position of the
+    // digit's least significant bit
+    bool bcderr{};
+    int8_t bcderr_symbol{};
+
+    // Simple BCD-decoder
+    int decode_bcd(int d, int c = -1, int b = -1, int a = -1) {
+        int r = (a >= 0 ? (sym(a) * 8) : 0) + (b >= 0 ? (sym(b) * 4) : 0) +
+                (c >= 0 ? (sym(c) * 2) : 0) + sym(d) * 1;
+        if (r > 9 && !bcderr) {
+            bcderr = true;
+            bcderr_symbol = d;
+        }
+        return r;
+    }
+
+    template <class... Ints>
+    int decode_bcd(int d, int c, int b, int a, Ints... rest) {
+        return decode_bcd(d, c, b, a) + 10 * decode_bcd(rest...);
+    }
+
+    template <class Stats> bool decode(wwvb_time &m, Stats &stats) {
+        // Callers try at every mark, so only count the attempts which are
+        // framed like a minute
+        if (sym(0) != 2 || sym(59) != 2)
+            return false;
+        for (int i = 1; i < 59; i++) {
+            int s = sym(i);
+            bool is_mark = i % 10 == 9;
+            if (is_mark != (s == 2))
+                return stats.fail(wwvb_decode_stats::mark, i);
+            bool is_zero = (i % 10 == 4) || i == 10 || i == 11 || i == 20 ||
+                           i == 21 || i == 35;
+            if (is_zero && s != 0)
+                return stats.fail(wwvb_decode_stats::zero, i);
+        }
+
+        m.year = decode_bcd(53, 52, 51, 50, 48, 47, 46, 45);
+        m.yday = decode_bcd(33, 32, 31, 30, 28, 27, 26, 25, 23, 22);
+        m.hour = decode_bcd(18, 17, 16, 15, 13, 12);
+        m.minute = decode_bcd(8, 7, 6, 5, 3, 2, 1);
+        m.ly = decode_bcd(55);
+        m.ls = decode_bcd(56);
+        m.dst = decode_bcd(58, 57);
+        m.second = 0;
+        int abs_dut1 = decode_bcd(43, 42, 41, 40);
+        int dut1_sign = decode_bcd(38, 37, 36);
+        if (bcderr)
+            return stats.fail(wwvb_decode_stats::bcd, bcderr_symbol);
+        switch (dut1_sign) {
+        case 2:
+            m.dut1 = -abs_dut1;
+            break;
+        case 5:
+            m.dut1 = abs_dut1;
+            break;
+        default:
+            return stats.fail(wwvb_decode_stats::dut1_sign, 36);
+        }
+        return stats.pass();
+    }
+};
+
+template <class Symbols, class Stats>
+bool wwvb_decode_minute(const Symbols &sym, wwvb_time &m, Stats &stats) {
+    return wwvb_minute_decoder<Symbols>(sym).decode(m, stats);
+}
+
+// A phase-locked second generator.  It tracks the start of second as a
+// phase, in 1/65536ths of a bucket, and how far it moves each second, which
+// is the local clock's frequency error.  Once a second, the measured start of
+// second nudges both, and the next tick is scheduled at the bucket where the
+// phase says the second begins.  The correction each second is bounded, so
+// once locked the ticks are never more than a bucket or so from SUBSEC
+// samples apart: a start of second wandering between neighbouring buckets
+// neither doubles a tick nor drops one.  A measurement far from the phase is
+// taken as an outlier, until it has persisted for STEP_SECONDS, when the
+// phase jumps to it.
+template <size_t SUBSEC> struct wwvb_second_pll {
+    static constexpr int32_t ONE = 1 << 16;
+    static constexpr int32_t CYCLE = SUBSEC * ONE;
+
+    // The most the phase is corrected, and the most it drifts, per second
+    static constexpr int32_t MAX_SLEW = ONE / 2;
+    static constexpr int32_t MAX_DRIFT = CYCLE / 100;
+
+    // A measurement this far from the phase is an outlier
+    static constexpr int32_t STEP = 2 * ONE;
+    static constexpr int STEP_SECONDS = 10;
+
+    int32_t phase{}, drift{};
+    // The length of the current second in samples
+    uint16_t period{SUBSEC};
+    bool locked{};
+    uint8_t outliers{};
+
+    static int32_t wrap(int32_t x) {
+        if (x >= CYCLE / 2)
+            return x - CYCLE;
+        if (x < -CYCLE / 2)
+            return x + CYCLE;
+        return x;
+    }
+
+    static int32_t wrap_positive(int32_t x) {
+        return x < 0 ? x + CYCLE : x >= CYCLE ? x - CYCLE : x;
+    }
+
+    static int32_t clamp(int32_t x, int32_t limit) {
+        return x > limit ? limit : x < -limit ? -limit : x;
+    }
+
+    // Called at a tick, when bucket `now` begins, with the measured start of
+    // second in 1/256ths of a bucket (see WWVBDecoder::sos_q8()), how many
+    // seconds old the measurement is on average, and whether it can be
+    // trusted.  Sets period to the number of samples to the next tick.
+    void second(int now, int32_t measured_q8, int age, bool trusted) {
+        if (trusted)
+            correct(measured_q8 * 256);
+        phase = wrap_positive(phase + drift);
+        // The first whole bucket of the second, brought up to date
+        int d = (wrap_positive(phase + drift * age) / ONE + 1) - now;
+        if (d >= int(SUBSEC) / 2)
+            d -= SUBSEC;
+        else if (d < -int(SUBSEC) / 2)
+            d += SUBSEC;
+        period = SUBSEC + d;
+    }
+
+    void correct(int32_t measured) {
+        int32_t e = wrap(measured - phase);
+        if (locked) {
+            if (e <= STEP && e >= -STEP) {
+                outliers = 0;
+                phase += clamp(e / 8, MAX_SLEW);
+                drift = clamp(drift + e / 128, MAX_DRIFT);
+                return;
+            }
+            if (++outliers < STEP_SECONDS)
+                return;
+        }
+        phase = measured;
+        locked = true;
+        outliers = 0;
+    }
+};
+
+// What a decoder without the PLL keeps of it
+struct wwvb_no_pll {
+    static constexpr int period = 0;
+    void second(int, int32_t, int, bool) {}
+};
+
+// The types of the fields of a WWVBDecoder; see there
+template <size_t SUBSEC_, size_t SYMBOLS_, size_t HISTORY_, bool COMPACT_,
+          bool PLL_>
+struct wwvb_decoder_types {
+    static constexpr size_t SUBSEC = SUBSEC_;
+    static constexpr size_t SYMBOLS = SYMBOLS_;
     static constexpr size_t HISTORY = HISTORY_;
-    static constexpr size_t BUFFER = SUBSEC * HISTORY_;
+    static constexpr size_t BUFFER = SUBSEC * HISTORY;
+    static constexpr bool COMPACT = COMPACT_;
+
+    // The adaptive window's least length in seconds
+    static constexpr size_t MIN_HISTORY = HISTORY < 10 ? HISTORY : 10;
 
     typedef circular_symbol_array<SYMBOLS, 2> symbol_buffer_type;
     typedef circular_bit_array<BUFFER> signal_buffer_type;
 
+    // counts range over 0..HISTORY and edges over -HISTORY..HISTORY
+    typedef typename std::conditional<COMPACT && HISTORY <= INT8_MAX, int8_t,
+                                      int16_t>::type count_type;
+    // Each symbol's health is at most SUBSEC
+    typedef typename std::conditional<
+        COMPACT, circular_symbol_array<SYMBOLS, bits_for(SUBSEC)>,
+        std::array<typename std::conditional<SUBSEC <= UINT8_MAX, uint8_t,
+                                             uint16_t>::type,
+                   SYMBOLS>>::type health_history_type;
+    typedef typename std::conditional<COMPACT, wwvb_no_decode_stats,
+                                      wwvb_decode_stats>::type
+        decode_stats_type;
+    typedef typename std::conditional<COMPACT, wwvb_no_lock_stats,
+                                      wwvb_lock_stats>::type lock_stats_type;
+    typedef typename std::conditional<PLL_, wwvb_second_pll<SUBSEC>,
+                                      wwvb_no_pll>::type pll_type;
+};
+
+// The fields are ordered by how often they are used.  The per-sample state
+// that update() touches comes first, together, starting on a cache line; the
+// per-second state follows on lines of its own.  The compact decoder is
+// packed instead.
+template <class T> struct wwvb_hot_cold_fields {
+    static constexpr size_t CACHE_LINE = T::COMPACT ? alignof(size_t) : 64;
+
     // Total number of samples ever received
-    size_t sample_count{};
+    alignas(CACHE_LINE) size_t sample_count{};
 
-    // Total number of symbols ever decoded
-    size_t symbol_count{};
+    // subsec counts the position modulo SUBSEC; sos is the start-of-second
+    // modulo SUBSEC.  tss is the time in ticks since the last second.
+    uint16_t subsec{}, sos{}, tss{};
 
-    // Raw samples from the receiver
-    signal_buffer_type signal{};
+    // The start-of-second to which quality is relative
+    uint16_t quality_sos{};
+
+    // With PLL, where the seconds come from
+    typename T::pll_type pll{};
+
+    // Signal quality; see quality_pct()
+    wwvb_signal_quality quality{};
 
     // Statistical information about the raw samples
-    std::array<int16_t, SUBSEC> counts{};
-    std::array<int16_t, SUBSEC> edges{};
+    std::array<typename T::count_type, T::SUBSEC> counts{};
+    std::array<typename T::count_type, T::SUBSEC> edges{};
+
+    // Raw samples from the receiver
+    typename T::signal_buffer_type signal{};
+
+    // With ADAPTIVE, the statistics cover the latest window_samples samples,
+    // which grows up to window seconds
+    uint32_t window_samples{};
+    uint16_t window{T::MIN_HISTORY};
+
+    // Total number of symbols ever decoded
+    alignas(CACHE_LINE) size_t symbol_count{};
 
     // Statistical information about the symbols
     int health{};
-    std::array<uint8_t, SYMBOLS> health_history{};
+    typename T::health_history_type health_history{};
 
-    // subsec counts the position modulo SUBSEC; sos is the start-of-second
-    // modulo SUBSEC.  tss is the time in ticks since the last second.
+    // Decoded symbols
+    typename T::symbol_buffer_type symbols{};
+
+    // Outcomes of decode_minute
+    mutable typename T::decode_stats_type decode_stats{};
+
+    // Time to lock and lock loss; see wwvb_lock_stats
+    mutable typename T::lock_stats_type lock{};
+};
+
+// The same fields in the order they had before they were grouped by use,
+// with those added since at the end.  Only the many_N benchmarks use it, to
+// measure what the grouping is worth.
+template <class T> struct wwvb_legacy_fields {
+    size_t sample_count{};
+    size_t symbol_count{};
+    typename T::signal_buffer_type signal{};
+    std::array<typename T::count_type, T::SUBSEC> counts{};
+    std::array<typename T::count_type, T::SUBSEC> edges{};
+    int health{};
+    typename T::health_history_type health_history{};
     uint16_t subsec{}, sos{}, tss{};
+    typename T::symbol_buffer_type symbols{};
+    mutable typename T::lock_stats_type lock{};
+    wwvb_signal_quality quality{};
+    uint16_t quality_sos{};
+    mutable typename T::decode_stats_type decode_stats{};
+    typename T::pll_type pll{};
+    uint32_t window_samples{};
+    uint16_t window{T::MIN_HISTORY};
+};
 
-    // Decoded symbols
-    symbol_buffer_type symbols{};
+template <class T, bool HOT_COLD>
+using wwvb_decoder_fields =
+    typename std::conditional<HOT_COLD, wwvb_hot_cold_fields<T>,
+                              wwvb_legacy_fields<T>>::type;
+
+// COMPACT selects the smallest footprint, for running many decoders at once:
+// counts and edges are 8 bits wide when HISTORY allows, the health of each
+// symbol is packed into just enough bits, and the decode and lock statistics
+// are left out.  The decoding itself is unchanged.
+//
+// ADAPTIVE lets the statistics cover fewer than HISTORY seconds: the window
+// starts at MIN_HISTORY seconds, grows by a second each second that the start
+// of second is clear, and drops back to MIN_HISTORY when another edge rivals
+// it, so that a new start of second (after a restart, or a step in the
+// receiver's delay) is found without waiting for old statistics to age out.
+//
+// PLL takes the seconds from a wwvb_second_pll instead of directly from the
+// sharpest edge, so that update() returns true exactly once a second.  The
+// sharpest edge is then only looked for once a second, at the tick.
+//
+// HOT_COLD orders the fields by use (wwvb_hot_cold_fields); without it they
+// keep their old order (wwvb_legacy_fields), for comparison.
+template <size_t SUBSEC_ = 50, size_t SYMBOLS_ = 60, size_t HISTORY_ = 40,
+          bool COMPACT_ = false, bool ADAPTIVE_ = false, bool PLL_ = false,
+          bool HOT_COLD_ = true>
+struct WWVBDecoder
+    : wwvb_decoder_fields<wwvb_decoder_types<SUBSEC_, SYMBOLS_, HISTORY_,
+                                             COMPACT_, PLL_>,
+                          HOT_COLD_> {
+    // The second is divided into units of SUBSEC
+    static constexpr size_t SUBSEC = SUBSEC_;
+
+    // This many WWVB symbols are accumulated
+    static constexpr size_t SYMBOLS = SYMBOLS_;
+
+    // This many whole seconds of symbols are accumulated for statistics.
+    // 5 seconds is too little history, 60 is plenty.  40 seems okay.
+    static constexpr size_t HISTORY = HISTORY_;
+    static constexpr size_t BUFFER = SUBSEC * HISTORY_;
+
+    static constexpr bool COMPACT = COMPACT_;
+    static constexpr bool ADAPTIVE = ADAPTIVE_;
+    static constexpr bool PLL = PLL_;
+    static constexpr bool HOT_COLD = HOT_COLD_;
+
+    // The start of second must be at least this sharp (see quality_pct())
+    // for the PLL to follow it
+    static constexpr int PLL_QUALITY_PCT = 20;
+
+    typedef wwvb_decoder_types<SUBSEC, SYMBOLS, HISTORY, COMPACT, PLL> types;
+    typedef wwvb_decoder_fields<types, HOT_COLD> fields;
+
+    // The adaptive window's least length in seconds
+    static constexpr size_t MIN_HISTORY = types::MIN_HISTORY;
+
+    typedef typename types::symbol_buffer_type symbol_buffer_type;
+    typedef typename types::signal_buffer_type signal_buffer_type;
+    typedef typename types::count_type count_type;
+    typedef typename types::health_history_type health_history_type;
+    typedef typename types::decode_stats_type decode_stats_type;
+    typedef typename types::lock_stats_type lock_stats_type;
+
+    using fields::sample_count;
+    using fields::subsec;
+    using fields::sos;
+    using fields::tss;
+    using fields::quality_sos;
+    using fields::pll;
+    using fields::quality;
+    using fields::counts;
+    using fields::edges;
+    using fields::signal;
+    using fields::window_samples;
+    using fields::window;
+    using fields::symbol_count;
+    using fields::health;
+    using fields::health_history;
+    using fields::symbols;
+    using fields::decode_stats;
+    using fields::lock;
 
     // Receive a sample `b` from the receiver and process:
     //  * update statistics (counts and edges) incrementally
@@ -147,38 +615,41 @@ struct WWVBDecoder {
     // Returns true if it is the START of a new WWVB second
 
     bool update(bool b) {
+        WWVB_STAGE_BEGIN(update);
+        WWVB_STAGE_BEGIN(counts);
         // Put the new bit & extract the old bit
         sample_count++;
         auto ob = signal.put(b);
+        if (ADAPTIVE)
+            ob = leaving_sample(ob);
 
         // Update the counts array
         if (b && !ob) {
             counts[subsec]++;
+            update_segment_counts(subsec, 1);
         } else if (!b && ob) {
             counts[subsec]--;
+            update_segment_counts(subsec, -1);
         }
 
         // Update the edges array
         auto subsec1 = subsec == SUBSEC - 1 ? 0 : subsec + 1;
+        int old_edge = edges[subsec];
         edges[subsec] = counts[subsec1] - counts[subsec];
+        update_edge_energy(subsec, old_edge, edges[subsec]);
+        WWVB_STAGE_END(counts);
 
-        // Check for sharpest edge
-        // can this be done without a whole array scan?
-        int bi = 0, best = 0;
-        for (size_t i = 0; i < SUBSEC; i++) {
-            if (edges[i] > best) {
-                bi = i;
-                best = edges[i];
-            }
-        }
         int osos = sos;
-        sos = bi == SUBSEC - 1 ? 0 : bi + 1;
+        if (!PLL)
+            find_sos();
 
         subsec = subsec1;
 
         bool result = false;
-        // If it's been a long time since the last second, fake one.
-        if (tss > SUBSEC) {
+        if (PLL) {
+            result = tss + 1 >= pll.period;
+        } else if (tss > SUBSEC) {
+            // If it's been a long time since the last second, fake one.
             result = true;
         } else if (tss > SUBSEC / 2) {
             // Otherwise, sos may be wandering, so don't repeat a second too
@@ -189,17 +660,209 @@ struct WWVBDecoder {
         // either reset or increment time-since-second
         if (result) {
             tss = 0;
+            if (PLL)
+                find_sos();
+            rebase_quality();
+            if (ADAPTIVE)
+                adapt_window();
+            if (PLL)
+                pll.second(subsec, sos_q8(), history_seconds() / 2,
+                           quality_pct() >= PLL_QUALITY_PCT);
             decode_symbol();
         } else {
             tss++;
         }
 
+        WWVB_STAGE_END_KIND(update, result, update_second, update_sample);
         return result;
     }
 
+    // Set sos from the sharpest edge
+    // can this be done without a whole array scan?
+    void find_sos() {
+        WWVB_STAGE_BEGIN(argmax);
+        int bi = 0, best = 0;
+        for (size_t i = 0; i < SUBSEC; i++) {
+            if (edges[i] > best) {
+                bi = i;
+                best = edges[i];
+            }
+        }
+        sos = bi == SUBSEC - 1 ? 0 : bi + 1;
+        WWVB_STAGE_END(argmax);
+    }
+
+    // The position of bucket i relative to the start of second of quality
+    int quality_bucket(int i) const {
+        i -= quality_sos;
+        return i < 0 ? i + SUBSEC : i;
+    }
+
+    void update_segment_counts(int i, int delta) {
+        int j = quality_bucket(i);
+        if (j < p1)
+            quality.count_a += delta;
+        else if (j >= p3)
+            quality.count_d += delta;
+    }
+
+    // edges[i] is the edge leading into bucket i+1
+    static bool near_sos(int j) { return j >= int(SUBSEC) - 3 || j < 2; }
+
+    // The offset of a near edge from the start-of-second edge, -2..2
+    static int near_offset(int j) {
+        return j >= int(SUBSEC) - 3 ? j - int(SUBSEC) + 1 : j + 1;
+    }
+
+    void update_edge_energy(int i, int old_edge, int new_edge) {
+        int d = (new_edge > 0 ? new_edge : 0) - (old_edge > 0 ? old_edge : 0);
+        quality.edge_energy += d;
+        int j = quality_bucket(i);
+        if (near_sos(j)) {
+            quality.near_energy += d;
+            quality.near_moment += d * near_offset(j);
+        }
+    }
+
+    // Once a second, make quality relative to the current start of second
+    // and find the peak and runner-up edges.  This costs O(SUBSEC), once per
+    // SUBSEC samples: unlike the sums, it is deliberately not kept up to
+    // date per sample.  The runner-up is a maximum over buckets that change
+    // in either direction, which would need a heap or tree updated on every
+    // sample, whereas the scan costs no more than the decode_symbol() that
+    // concludes the same second.
+    void rebase_quality() {
+        if (quality_sos != sos) {
+            quality_sos = sos;
+            quality.count_a = quality.count_d = quality.near_energy = 0;
+            quality.near_moment = 0;
+            for (size_t i = 0; i < SUBSEC; i++) {
+                int j = quality_bucket(i);
+                if (near_sos(j) && edges[i] > 0) {
+                    quality.near_energy += edges[i];
+                    quality.near_moment += edges[i] * near_offset(j);
+                }
+                if (j < p1)
+                    quality.count_a += counts[i];
+                else if (j >= p3)
+                    quality.count_d += counts[i];
+            }
+        }
+        // The sharpest edge is the one that set sos
+        int peak = edges[sos ? sos - 1 : SUBSEC - 1];
+        quality.peak = peak > 0 ? peak : 0;
+        int runner_up = 0;
+        for (int j = 2; j < int(SUBSEC) - 3; j++) {
+            int i = sos + j;
+            if (i >= int(SUBSEC))
+                i -= SUBSEC;
+            if (edges[i] > runner_up)
+                runner_up = edges[i];
+        }
+        quality.runner_up = runner_up;
+    }
+
+    // The sample leaving the adaptive window, given the one leaving the whole
+    // buffer; none while the window grows
+    bool leaving_sample(bool ob) {
+        if (window_samples < window * SUBSEC) {
+            window_samples++;
+            return false;
+        }
+        return window_samples == BUFFER ? ob
+                                        : signal.at(BUFFER - 1 - window_samples);
+    }
+
+    // Once a second, grow the window while no other edge is half as sharp as
+    // the start of second, and shrink it when one is
+    void adapt_window() {
+        if (quality.runner_up * 2 > quality.peak) {
+            if (window > MIN_HISTORY)
+                shrink_window(MIN_HISTORY);
+        } else if (window < HISTORY && window_samples == window * SUBSEC) {
+            window++;
+        }
+    }
+
+    // Forget all but the latest w seconds of samples.  This costs
+    // O(samples forgotten + SUBSEC), but only when the signal changes.
+    void shrink_window(size_t w) {
+        window = w;
+        int bucket = subsec; // one past that of the latest sample
+        for (size_t age = 1; age <= window_samples; age++) {
+            bucket = bucket ? bucket - 1 : SUBSEC - 1;
+            if (age > w * SUBSEC && signal.at(BUFFER - age)) {
+                counts[bucket]--;
+                update_segment_counts(bucket, -1);
+            }
+        }
+        if (window_samples > w * SUBSEC)
+            window_samples = w * SUBSEC;
+        for (size_t i = 0; i < SUBSEC; i++) {
+            int old_edge = edges[i];
+            edges[i] = counts[i == SUBSEC - 1 ? 0 : i + 1] - counts[i];
+            update_edge_energy(i, old_edge, edges[i]);
+        }
+        rebase_quality();
+    }
+
+    // The seconds of samples the statistics cover
+    int history_seconds() const {
+        if (!ADAPTIVE)
+            return HISTORY;
+        return window_samples < SUBSEC ? 1 : window_samples / SUBSEC;
+    }
+
+    // The start of second to a fraction of a bucket, in 1/256ths of a bucket
+    // from the start of bucket 0: where the reduced carrier begins, estimated
+    // as the centroid of the edges near the start of second.  The receiver's
+    // jitter spreads the edge over several buckets, and its centroid falls
+    // between them.  Like the other indicators, this is relative to the start
+    // of second as of the most recent second.
+    int32_t sos_q8() const {
+        int32_t x = (quality_sos ? quality_sos - 1 : SUBSEC - 1) * 256 + 128;
+        if (quality.near_energy > 0)
+            x += quality.near_moment * 256 / quality.near_energy;
+        if (x < 0)
+            x += SUBSEC * 256;
+        else if (x >= int32_t(SUBSEC * 256))
+            x -= SUBSEC * 256;
+        return x;
+    }
+
+    // Percentage of the positive edge energy at the start of second
+    int focus_pct() const {
+        return quality.edge_energy
+                   ? quality.near_energy * 100 / quality.edge_energy
+                   : 0;
+    }
+
+    // How far the always-reduced and never-reduced parts of the second are
+    // apart, as a percentage of the ideal
+    int contrast_pct() const {
+        int c = (quality.count_a * ld - quality.count_d * la) * 100 /
+                int(la * ld * history_seconds());
+        return c < 0 ? 0 : c;
+    }
+
+    // How far the sharpest edge stands above the runner-up, as a percentage
+    // of the sharpest; as of the most recent second
+    int sharpness_pct() const {
+        if (quality.peak <= 0)
+            return 0;
+        int s = (quality.peak - quality.runner_up) * 100 / quality.peak;
+        return s < 0 ? 0 : s;
+    }
+
+    // One figure of merit, 0 to 100
+    int quality_pct() const {
+        int f = focus_pct(), c = contrast_pct();
+        return f < c ? f : c;
+    }
+
     // Return how many items from i..j in the raw data array are true
     // (true represents the reduced-carrier state)
-    int count(int i, int j) {
+    int count(int i, int j) const {
         int result = 0;
         for (; i < j; i++) {
             result += signal.at(i);
@@ -226,10 +889,11 @@ struct WWVBDecoder {
     // In around 300 hours of logs from the WWVB observatory, the current
     // algorithm decoded 16004 minutes (at all, not back-checked for
     // correctness).  Of those, minutes about 86% had health above 97%.  That
-    // makes 97% a plausible threshold for a healthy signal.
+    // makes 97% a plausible threshold for a healthy signal.  (`accuracy` can
+    // back-check a log's minutes, given the time the log starts.)
     static constexpr auto HEALTH_97PCT = MAX_HEALTH * 97 / 100;
 
-    int check_health(int count, int length, int expect) {
+    int check_health(int count, int length, int expect) const {
         return expect ? count : length - count;
     }
 
@@ -237,16 +901,41 @@ struct WWVBDecoder {
     // the second, and signal.at(BUFFER-SUBSEC) is the first sample of the
     // second
     void decode_symbol() {
+        WWVB_STAGE_BEGIN(decode_symbol);
         constexpr auto OFFSET = BUFFER - SUBSEC;
 #if 0
         for(size_t i=0; i<SUBSEC; i++) {
             printf("%c", signal.at(OFFSET + i) ? '_' : '#');
         }
 #endif
-        int count_a = count(OFFSET + p0, OFFSET + p1);
-        int count_b = count(OFFSET + p1, OFFSET + p2);
-        int count_c = count(OFFSET + p2, OFFSET + p3);
-        int count_d = count(OFFSET + p3, OFFSET + p4);
+        int h;
+        int result = read_symbol(OFFSET, h);
+
+        int sc = symbol_count++;
+        int si = sc % SYMBOLS;
+        int oh = exchange_health(health_history, si, h);
+        health += (h - oh);
+
+        symbols.put(result);
+        track_lock(result, h);
+        WWVB_STAGE_END(decode_symbol);
+
+#if 0
+        printf(" %d\n", result);
+        for(size_t i=0; i<SYMBOLS; i++) {
+            printf("%d", symbols.at(i));
+        }
+        printf("\n", result);
+#endif
+    }
+
+    // The symbol of the second whose first sample is signal.at(offset), and
+    // its health in h
+    int read_symbol(int offset, int &h) const {
+        int count_a = count(offset + p0, offset + p1);
+        int count_b = count(offset + p1, offset + p2);
+        int count_c = count(offset + p2, offset + p3);
+        int count_d = count(offset + p3, offset + p4);
 
         int result = 0;
 
@@ -260,7 +949,7 @@ struct WWVBDecoder {
             result = 1;
         }
 
-        int h = 0;
+        h = 0;
         if (result != 3) {
             h += check_health(count_a, la, 1);
             h += check_health(count_b, lb, result != 0);
@@ -268,75 +957,36 @@ struct WWVBDecoder {
             h += check_health(count_d, ld, 0);
         }
 
-        int sc = symbol_count++;
-        int si = sc % SYMBOLS;
-        int oh = health_history[si];
-        health_history[si] = h;
-        health += (h - oh);
-
-        symbols.put(result);
-
-#if 0
-        printf(" %d\n", result);
-        for(size_t i=0; i<SYMBOLS; i++) {
-            printf("%d", symbols.at(i));
-        }
-        printf("\n", result);
-#endif
+        return result;
     }
 
-    mutable bool bcderr;
-
-    // Simple BCD-decoder
-    int decode_bcd(int d, int c = -1, int b = -1, int a = -1) const {
-        int r = (a >= 0 ? (symbols.at(SYMBOLS - 60 + a) * 8) : 0) +
-                (b >= 0 ? (symbols.at(SYMBOLS - 60 + b) * 4) : 0) +
-                (c >= 0 ? (symbols.at(SYMBOLS - 60 + c) * 2) : 0) +
-                symbols.at(SYMBOLS - 60 + d) * 1;
-        if (r > 9)
-            bcderr = true;
-        return r;
+    void track_lock(int symbol, int h) {
+        lock.second(sample_count, SUBSEC, sos,
+                    symbol != 3 && h >= int(SUBSEC * 97 / 100),
+                    health >= int(HEALTH_97PCT));
     }
 
-    template <class... Ints>
-    int decode_bcd(int d, int c, int b, int a, Ints... rest) const {
-        return decode_bcd(d, c, b, a) + 10 * decode_bcd(rest...);
+    // Called for each valid minute; the firmware, which decodes a copy of
+    // the decoder, calls it on the original as well
+    void track_valid_minute(uint64_t sample, int minute_health) const {
+        lock.valid_minute(sample, SUBSEC, minute_health >= int(HEALTH_97PCT));
     }
 
     // barebones decoding of some minute-fields
-    inline bool decode_minute(wwvb_time &m) const {
-        for (int i = 0; i < 60; i++) {
-            int sym = symbols.at(SYMBOLS - 60 + i);
-            bool is_mark = (i == 0) || (i % 10 == 9);
-            if (is_mark != (sym == 2))
-                return false;
-            bool is_zero = (i % 10 == 4) || i == 10 || i == 11 || i == 20 ||
-                           i == 21 || i == 35;
-            if (is_zero && sym != 0)
-                return false;
-        }
+    bool decode_minute(wwvb_time &m) const {
+        WWVB_STAGE_BEGIN(decode_minute);
+        bool result = decode_minute_fields(m);
+        WWVB_STAGE_END(decode_minute);
+        return result;
+    }
 
-        bcderr = false;
-        m.year = decode_bcd(53, 52, 51, 50, 48, 47, 46, 45);
-        m.yday = decode_bcd(33, 32, 31, 30, 28, 27, 26, 25, 23, 22);
-        m.hour = decode_bcd(18, 17, 16, 15, 13, 12);
-        m.minute = decode_bcd(8, 7, 6, 5, 3, 2, 1);
-        m.ly = decode_bcd(55);
-        m.ls = decode_bcd(56);
-        m.dst = decode_bcd(58, 57);
-        m.second = 0;
-        int abs_dut1 = decode_bcd(43, 42, 41, 40);
-        int dut1_sign = decode_bcd(38, 37, 36);
-        switch (dut1_sign) {
-        case 2:
-            m.dut1 = -abs_dut1;
-            break;
-        case 5:
-            m.dut1 = abs_dut1;
-            break;
-        default:
-            bcderr = true;
-        }
-        return !bcderr;
+    bool decode_minute_fields(wwvb_time &m) const {
+        auto minute_symbol = [this](int i) {
+            return symbols.at(SYMBOLS - 60 + i);
+        };
+        if (!wwvb_decode_minute(minute_symbol, m, decode_stats))
+            return false;
+        track_valid_minute(sample_count, health);
+        return true;
     }
 };
@@ -0,0 +1,149 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Streaming decompression of gzip and xz input for the host decoder.  The
+// decompressor consumes raw_blocks of compressed data and produces
+// raw_blocks of decompressed data, so it slots into the pipeline as its own
+// stage between the reader and the unpacker.
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "pipeline.h"
+
+enum class compression { none, gzip, xz };
+
+// Identify the compression format from the first bytes of the input
+inline compression detect_compression(const unsigned char *data, size_t len) {
+    static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+    static const unsigned char xz_magic[] = {0xfd, '7', 'z', 'X', 'Z', 0};
+    if (len >= sizeof(gzip_magic) &&
+        !memcmp(data, gzip_magic, sizeof(gzip_magic)))
+        return compression::gzip;
+    if (len >= sizeof(xz_magic) && !memcmp(data, xz_magic, sizeof(xz_magic)))
+        return compression::xz;
+    return compression::none;
+}
+
+// Concatenated gzip members and concatenated xz streams are both accepted,
+// as produced by e.g., `cat a.gz b.gz` or `pigz`.
+struct stream_decompressor {
+    explicit stream_decompressor(compression kind) : kind(kind) {
+        out.len = 0;
+        if (kind == compression::gzip) {
+            zs = {};
+            ok = inflateInit2(&zs, 15 + 16) == Z_OK;
+        } else {
+            xs = LZMA_STREAM_INIT;
+            ok = lzma_stream_decoder(&xs, UINT64_MAX, LZMA_CONCATENATED) ==
+                 LZMA_OK;
+        }
+        if (!ok)
+            message = "cannot initialize decompressor";
+    }
+
+    ~stream_decompressor() {
+        if (kind == compression::gzip)
+            inflateEnd(&zs);
+        else
+            lzma_end(&xs);
+    }
+
+    stream_decompressor(const stream_decompressor &) = delete;
+    stream_decompressor &operator=(const stream_decompressor &) = delete;
+
+    // Calls emit(const raw_block &) for every block of decompressed data.
+    // Returns false on corrupt input.
+    template <class F> bool feed(const raw_block &in, F &&emit) {
+        return run(in.data, in.len, false, emit);
+    }
+
+    // Flushes the remaining output.  Returns false if the input was
+    // truncated or corrupt.
+    template <class F> bool finish(F &&emit) {
+        bool result = run(nullptr, 0, true, emit);
+        if (out.len)
+            emit(out);
+        out.len = 0;
+        if (result && in_member) {
+            message = "truncated gzip input";
+            result = false;
+        }
+        return result;
+    }
+
+    const char *error() const { return message; }
+
+  private:
+    template <class F>
+    bool run(const unsigned char *data, size_t len, bool last, F &&emit) {
+        if (!ok)
+            return false;
+        if (kind == compression::gzip)
+            return run_gzip(data, len, emit);
+        return run_xz(data, len, last, emit);
+    }
+
+    template <class F>
+    bool run_gzip(const unsigned char *data, size_t len, F &&emit) {
+        zs.next_in = const_cast<unsigned char *>(data);
+        zs.avail_in = len;
+        while (zs.avail_in) {
+            zs.next_out = out.data + out.len;
+            zs.avail_out = raw_block::SIZE - out.len;
+            int r = inflate(&zs, Z_NO_FLUSH);
+            out.len = raw_block::SIZE - zs.avail_out;
+            in_member = true;
+            if (r == Z_STREAM_END) {
+                // Another member may follow
+                inflateReset(&zs);
+                in_member = false;
+            } else if (r != Z_OK && r != Z_BUF_ERROR) {
+                message = zs.msg ? zs.msg : "inflate failed";
+                return ok = false;
+            }
+            if (out.len == raw_block::SIZE) {
+                emit(out);
+                out.len = 0;
+            }
+        }
+        return true;
+    }
+
+    template <class F>
+    bool run_xz(const unsigned char *data, size_t len, bool last, F &&emit) {
+        xs.next_in = data;
+        xs.avail_in = len;
+        lzma_action action = last ? LZMA_FINISH : LZMA_RUN;
+        while (xs.avail_in || last) {
+            xs.next_out = out.data + out.len;
+            xs.avail_out = raw_block::SIZE - out.len;
+            lzma_ret r = lzma_code(&xs, action);
+            out.len = raw_block::SIZE - xs.avail_out;
+            if (out.len == raw_block::SIZE) {
+                emit(out);
+                out.len = 0;
+            }
+            if (r == LZMA_STREAM_END)
+                break;
+            if (r != LZMA_OK) {
+                message = r == LZMA_BUF_ERROR ? "truncated xz input"
+                                              : "xz decoding failed";
+                return ok = false;
+            }
+        }
+        return true;
+    }
+
+    compression kind;
+    bool ok{}, in_member{};
+    const char *message{};
+    z_stream zs;
+    lzma_stream xs;
+    raw_block out;
+};
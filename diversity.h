@@ -0,0 +1,115 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Diversity combining of two receivers, such as two antennas at right angles,
+// into one decoder.  Each receiver also drives a tracking decoder of its own,
+// which finds its start of second.  The earlier of the two streams is delayed
+// so their seconds line up, and then each sample of the combined stream is
+// the one the receivers agree on, or where they differ, the one from the
+// receiver which has lately been more reliable.
+//
+// Reliability is judged from the parts of each second whose value is known
+// whatever the symbol: the first 200ms is always reduced carrier and the last
+// 200ms never is.  Each receiver's weight is a running average of how many
+// of those samples it got right in the recent seconds of the combined
+// stream, so a fade on one receiver quickly hands the decision to the other.
+// The trackers' health and start-of-second sharpness are left out of the
+// weight: they average over most of a minute, and lag a fade by so much
+// that scaling the weight by them lost more minutes than it saved.
+// Sharpness decides instead when the streams may be aligned.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "decoder.h"
+
+template <class Decoder = WWVBDecoder<>, class Tracker = Decoder>
+struct wwvb_diversity_combiner {
+    static constexpr size_t SUBSEC = Decoder::SUBSEC;
+    static constexpr auto p1 = Decoder::p1, p3 = Decoder::p3;
+
+    // The combined stream's decoder; use it as if it were fed directly
+    Decoder dec;
+
+    // Each receiver on its own
+    std::array<Tracker, 2> trackers{};
+
+    // How many samples stream 1's seconds start after stream 0's.  The
+    // combined stream follows the later one.
+    int offset{};
+
+    // The start-of-second edges of a tracker must be at least this sharp
+    // (see quality_pct()) before its start of second is used for alignment
+    static constexpr int ALIGN_QUALITY_PCT = 20;
+
+    // Running average of the per-second score of each receiver, times 4
+    std::array<int, 2> weight{};
+
+    // Samples in the known parts of the current second that each receiver
+    // got right
+    std::array<int, 2> score{};
+
+    // Recent samples of each receiver, for delaying the earlier one
+    std::array<std::array<uint8_t, SUBSEC>, 2> recent{};
+    uint16_t pos{};
+
+    // Receive a sample from each receiver.  Returns true at the START of a
+    // new second of the combined stream.
+    bool update(bool s0, bool s1) {
+        bool second = trackers[0].update(s0);
+        second |= trackers[1].update(s1);
+        if (second)
+            align();
+
+        recent[0][pos] = s0;
+        recent[1][pos] = s1;
+        int d0 = offset > 0 ? offset : 0, d1 = offset < 0 ? -offset : 0;
+        bool a = delayed(0, d0), b = delayed(1, d1);
+        pos = pos == SUBSEC - 1 ? 0 : pos + 1;
+
+        // The position of this sample in the combined stream's second
+        int j = dec.subsec - dec.sos;
+        if (j < 0)
+            j += SUBSEC;
+        if (j < p1) {
+            score[0] += a;
+            score[1] += b;
+        } else if (j >= p3) {
+            score[0] += !a;
+            score[1] += !b;
+        }
+
+        bool merged = a == b || weight[0] >= weight[1] ? a : b;
+        bool result = dec.update(merged);
+        if (result) {
+            for (int k = 0; k < 2; k++) {
+                weight[k] += score[k] - weight[k] / 4;
+                score[k] = 0;
+            }
+        }
+        return result;
+    }
+
+    // The sample of receiver k from d samples ago (d < SUBSEC)
+    bool delayed(int k, int d) const {
+        int i = pos - d;
+        return recent[k][i < 0 ? i + SUBSEC : i];
+    }
+
+    // Follow the difference between the receivers' starts of second, while
+    // both are sharp enough to trust
+    void align() {
+        if (trackers[0].quality_pct() < ALIGN_QUALITY_PCT ||
+            trackers[1].quality_pct() < ALIGN_QUALITY_PCT)
+            return;
+        int d = int(trackers[1].sos) - int(trackers[0].sos);
+        if (d > int(SUBSEC) / 2)
+            d -= SUBSEC;
+        else if (d <= -int(SUBSEC) / 2)
+            d += SUBSEC;
+        offset = d;
+    }
+};
@@ -0,0 +1,281 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// The firmware, run on the host against a simulated board (hal_sim.h) and
+// a synthetic or recorded receiver, faster than real time.  The timer
+// interrupt fires whenever TC3 reaches the compare value that the firmware's
+// steering sets, on a crystal that is clock_ppm off, and between interrupts
+// the main loop runs its queued work.  Each piece of work takes its host
+// time, times the slowdown, of simulated time, and interrupts that fall due
+// meanwhile are taken before the next piece, so the work queue backs up as
+// it would on a slower board.
+//
+// The report covers the interrupt handler's time, how long interrupts were
+// masked, the time of each kind of work, the deepest the work queue got,
+// the minutes decoded, and how well steering cancelled the crystal's error.
+
+#define CWWVB_SIM
+#include "cwwvb.ino"
+
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "decompress.h"
+#include "generator.h"
+#include "pipeline.h"
+
+struct options {
+    double hours = 1;
+    double clock_ppm = -300;
+    double slowdown = 1;
+    bool verbose = false;
+    unsigned min_minutes = 0;
+    double max_ppm = -1;
+    std::vector<double> keypresses;
+    wwvb_signal_config config;
+    input_format fmt = input_format::ascii;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [-d hours] [-n noise] [-f fades_per_hour] [-S seed]\n"
+            "          [-c clock_ppm] [-s slowdown] [-x seconds]...\n"
+            "          [-m min_minutes] [-p max_ppm] [-v] [-i ascii|packed]\n"
+            "          [recording]\n"
+            "Runs the firmware against a synthetic signal, or a recording at\n"
+            "%d samples per second.  -x presses 'x' at the given time; -v\n"
+            "shows the firmware's output.  The exit status is 1 if fewer than\n"
+            "min_minutes are decoded or the steered clock ends more than\n"
+            "max_ppm off.\n",
+            argv0, int(dec.SUBSEC));
+    exit(2);
+}
+
+static bool load(const char *path, input_format fmt,
+                 std::vector<uint8_t> &samples) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    std::vector<raw_block> blocks;
+    std::unique_ptr<raw_block> raw(new raw_block);
+    for (ssize_t n; (n = read(fd, raw->data, raw_block::SIZE)) > 0;) {
+        raw->len = n;
+        blocks.push_back(*raw);
+    }
+    close(fd);
+
+    sample_unpacker unpack(fmt);
+    auto emit = [&](const sample_block &b) {
+        for (size_t i = 0; i < b.len; i++)
+            samples.push_back(b.at(i));
+    };
+    auto kind = blocks.empty() ? compression::none
+                               : detect_compression(blocks[0].data,
+                                                    blocks[0].len);
+    if (kind == compression::none) {
+        for (const auto &b : blocks)
+            unpack.feed(b, emit);
+    } else {
+        stream_decompressor inflater(kind);
+        auto feed = [&](const raw_block &b) { unpack.feed(b, emit); };
+        bool ok = true;
+        for (const auto &b : blocks)
+            ok = ok && inflater.feed(b, feed);
+        if (!ok || !inflater.finish(feed)) {
+            fprintf(stderr, "%s: %s\n", path, inflater.error());
+            return false;
+        }
+    }
+    unpack.finish(emit);
+    return true;
+}
+
+static void print_stats(FILE *f, const char *name,
+                        const wwvb_stage_stats &s, double slowdown) {
+    fprintf(f, "%-12s %9lu calls, mean %9.0f ns, max %9.0f ns\n", name,
+            (unsigned long)s.count, s.mean() * slowdown, s.max * slowdown);
+}
+
+int main(int argc, char **argv) {
+    options o;
+    parse_utc("2021-11-06T12:00Z", o.config.start);
+    for (int opt; (opt = getopt(argc, argv, "d:n:f:S:c:s:x:m:p:vi:")) != -1;) {
+        switch (opt) {
+        case 'd':
+            o.hours = atof(optarg);
+            break;
+        case 'n':
+            o.config.flip_probability = atof(optarg);
+            break;
+        case 'f':
+            o.config.fades_per_hour = atof(optarg);
+            break;
+        case 'S':
+            o.config.seed = strtoull(optarg, nullptr, 0);
+            break;
+        case 'c':
+            o.clock_ppm = atof(optarg);
+            break;
+        case 's':
+            o.slowdown = atof(optarg);
+            break;
+        case 'x':
+            o.keypresses.push_back(atof(optarg));
+            break;
+        case 'm':
+            o.min_minutes = atoi(optarg);
+            break;
+        case 'p':
+            o.max_ppm = atof(optarg);
+            break;
+        case 'v':
+            o.verbose = true;
+            break;
+        case 'i':
+            if (!strcmp(optarg, "ascii"))
+                o.fmt = input_format::ascii;
+            else if (!strcmp(optarg, "packed"))
+                o.fmt = input_format::packed;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1)
+        usage(argv[0]);
+
+    // The receiver: a recording, taken as sampled on an exact clock, or a
+    // synthetic signal sampled finely enough that the board's own sampling
+    // instants matter
+    std::vector<uint8_t> recorded;
+    double duration = o.hours * 3600;
+    o.config.rate = 1000;
+    wwvb_signal_generator gen(o.config);
+    bool generated{};
+    if (optind < argc) {
+        if (!load(argv[optind], o.fmt, recorded))
+            return 1;
+        duration = double(recorded.size()) / dec.SUBSEC;
+        sim_hal.receiver = [&](double t) {
+            size_t k = t * dec.SUBSEC;
+            return k < recorded.size() && recorded[k];
+        };
+    } else {
+        sim_hal.receiver = [&](double t) {
+            while (gen.sample_count <= t * o.config.rate)
+                generated = gen.next();
+            return generated;
+        };
+    }
+    sim_hal.receiver_pin = PIN_OUT;
+    sim_hal.clock_ppm = o.clock_ppm;
+    std::sort(o.keypresses.begin(), o.keypresses.end());
+
+    // The firmware draws on the terminal; keep that out of the report
+    FILE *report = fdopen(dup(1), "w");
+    if (!o.verbose) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+    }
+
+    setup();
+
+    wwvb_stage_stats isr, decode_work, tick_work;
+    size_t max_depth = 0, keys = 0;
+    double first_fix = -1;
+    // Sample periods over the second half of the run, for the steered rate
+    double steered_time = 0;
+    uint64_t steered_samples = 0;
+
+    double next_interrupt = sim_hal.period(TC3->COUNT16.CC[0].reg);
+    double busy_until = 0;
+    auto host_start = std::chrono::steady_clock::now();
+    while (next_interrupt < duration) {
+        sim_hal.now = next_interrupt;
+        for (; keys < o.keypresses.size() && o.keypresses[keys] <= sim_hal.now;
+             keys++)
+            sim_hal.serial_in.push_back('x');
+
+        sim_hal.receiver_output = sim_hal.receiver(sim_hal.now);
+        auto t0 = std::chrono::steady_clock::now();
+        sim_hal.isr();
+        uint32_t isr_ns = sim_hal.ns_since(t0);
+        isr.record(isr_ns);
+        busy_until = std::max(busy_until, sim_hal.now) +
+                     isr_ns * o.slowdown * 1e-9;
+        max_depth = std::max<size_t>(max_depth,
+                                     (wq.head - wq.tail + wq.size) % wq.size);
+
+        // The compare value takes effect from this interrupt
+        double period = sim_hal.period(TC3->COUNT16.CC[0].reg);
+        next_interrupt += period;
+        if (sim_hal.now >= duration / 2) {
+            steered_time += period;
+            steered_samples++;
+        }
+
+        // The main loop runs until it sleeps or the next interrupt is due
+        while (busy_until < next_interrupt) {
+            work next = wq.empty() ? nullptr : wq.todo[wq.tail];
+            sim_hal.idle = false;
+            auto t1 = std::chrono::steady_clock::now();
+            loop();
+            uint32_t ns = sim_hal.ns_since(t1);
+            if (next == try_decode)
+                decode_work.record(ns);
+            else if (next == tick)
+                tick_work.record(ns);
+            busy_until += ns * o.slowdown * 1e-9;
+            if (ever_set && first_fix < 0)
+                first_fix = busy_until;
+            if (sim_hal.idle)
+                break;
+        }
+    }
+    double host_seconds = sim_hal.ns_since(host_start) * 1e-9;
+
+    const auto &st = dec.decode_stats;
+    unsigned minutes = st.count[st.ok];
+    double ppm = steered_samples ? (steered_time / steered_samples *
+                                        dec.SUBSEC -
+                                    1) *
+                                       1e6
+                                 : 0;
+    fprintf(report,
+            "simulated    %9.0f s in %.2f s (%.0fx real time), slowdown "
+            "%g\n",
+            duration, host_seconds, duration / host_seconds, o.slowdown);
+    print_stats(report, "interrupt", isr, o.slowdown);
+    print_stats(report, "masked", sim_hal.masked, o.slowdown);
+    print_stats(report, "try_decode", decode_work, o.slowdown);
+    print_stats(report, "tick", tick_work, o.slowdown);
+    fprintf(report, "queue depth  %9zu of %d\n", max_depth, wq.size - 1);
+    fprintf(report, "minutes      %9u decoded, %lu failed, first fix %.1f s\n",
+            minutes, (unsigned long)st.failures(), first_fix);
+    fprintf(report,
+            "steering     %+9.1f ppm after %+.0f ppm crystal, cc %d, sos "
+            "%d\n",
+            ppm, o.clock_ppm, cc, int(dec.sos));
+
+    bool ok = true;
+    if (minutes < o.min_minutes) {
+        fprintf(report, "FAIL: fewer than %u minutes\n", o.min_minutes);
+        ok = false;
+    }
+    if (o.max_ppm >= 0 && std::abs(ppm) > o.max_ppm) {
+        fprintf(report, "FAIL: steered clock more than %g ppm off\n",
+                o.max_ppm);
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
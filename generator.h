@@ -0,0 +1,277 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// A deterministic synthetic WWVB receiver.  It produces the sampled logic
+// output of a receiver for any start time and duration, modelling:
+//  * the receiver's phase shift, which wanders between delay_min_ms and
+//    delay_max_ms, with some extra jitter on the rising edge
+//  * the local oscillator running drift_ppm fast (or slow, if negative)
+//  * single-sample bit flips
+//  * burst fades, during which the output is noise
+//  * leap seconds (positive only) and the DST warning bits
+// The same config and seed always produce the same samples.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+#include "decoder.h"
+
+// Encode the fields of w as the 60 symbols of a WWVB minute (0, 1, or 2 for
+// a mark)
+inline void wwvb_encode_minute(const wwvb_time &w, uint8_t sym[60]) {
+    for (int i = 0; i < 60; i++)
+        sym[i] = (i == 0 || i % 10 == 9) ? 2 : 0;
+    // positions are listed from the least significant bit, 4 per digit
+    auto bcd = [&](int value, std::initializer_list<int> pos) {
+        int digit_bits = 0, weight = 1;
+        for (int p : pos) {
+            sym[p] = (value / weight) % 10 >> digit_bits & 1;
+            if (++digit_bits == 4) {
+                digit_bits = 0;
+                weight *= 10;
+            }
+        }
+    };
+    bcd(w.minute, {8, 7, 6, 5, 3, 2, 1});
+    bcd(w.hour, {18, 17, 16, 15, 13, 12});
+    bcd(w.yday, {33, 32, 31, 30, 28, 27, 26, 25, 23, 22});
+    bcd(w.year, {53, 52, 51, 50, 48, 47, 46, 45});
+    bcd(w.dut1 < 0 ? -w.dut1 : w.dut1, {43, 42, 41, 40});
+    bcd(w.dut1 < 0 ? 2 : 5, {38, 37, 36});
+    sym[55] = w.ly;
+    sym[56] = w.ls;
+    sym[57] = w.dst >> 1;
+    sym[58] = w.dst & 1;
+}
+
+// Parse a UTC time given as YYYY-MM-DD[THH:MM[:SS]][Z] or as @seconds
+inline bool parse_utc(const char *s, time_t &t) {
+    long long epoch;
+    int n = 0;
+    if (sscanf(s, "@%lld%n", &epoch, &n) == 1 && !s[n]) {
+        t = epoch;
+        return true;
+    }
+    struct tm tm = {};
+    int fields = sscanf(s, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                        &n);
+    if (fields != 3)
+        return false;
+    s += n;
+    if (*s == 'T' || *s == ' ') {
+        n = 0;
+        if (sscanf(s + 1, "%d:%d%n", &tm.tm_hour, &tm.tm_min, &n) != 2)
+            return false;
+        s += 1 + n;
+        if (*s == ':') {
+            n = 0;
+            if (sscanf(s + 1, "%d%n", &tm.tm_sec, &n) != 1)
+                return false;
+            s += 1 + n;
+        }
+    }
+    if (*s == 'Z')
+        s++;
+    if (*s)
+        return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    t = timegm(&tm);
+    return true;
+}
+
+// Small, fast and deterministic (xoshiro256**, seeded by splitmix64)
+struct wwvb_rng {
+    explicit wwvb_rng(uint64_t seed) {
+        for (auto &si : s) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            si = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        auto rotl = [](uint64_t x, int k) { return (x << k) | (x >> (64 - k)); };
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, 1)
+    double uniform() { return (next() >> 11) * 0x1p-53; }
+
+    uint64_t s[4];
+};
+
+struct wwvb_signal_config {
+    time_t start;  // UTC; need not be on a minute or second boundary
+    int rate = 50; // samples per second
+    double delay_min_ms = 40, delay_max_ms = 80;
+    double drift_ppm = 0;
+    double flip_probability = 0;  // per sample
+    double fades_per_hour = 0;    // average rate of burst fades
+    double fade_seconds = 5;      // average length of a burst fade
+    int dut1 = 3;                 // tenths of a second
+    time_t leap_second_day = 0;   // any time on the UTC day (June 30 or
+                                  // December 31) ending in a leap second
+    uint64_t seed = 1;
+};
+
+struct wwvb_signal_generator {
+    explicit wwvb_signal_generator(const wwvb_signal_config &config)
+        : config(config), rng(config.seed) {
+        flip_threshold = config.flip_probability >= 1
+                             ? UINT64_MAX
+                             : uint64_t(config.flip_probability * 0x1p64);
+        sample_period = 1. / config.rate / (1 + config.drift_ppm * 1e-6);
+        if (config.leap_second_day) {
+            // The leap second follows 23:59:59 on the leap day
+            leap_at = config.leap_second_day - config.leap_second_day % 86400 +
+                      86400;
+            struct tm tm;
+            gmtime_r(&config.leap_second_day, &tm);
+            tm.tm_mday = 1;
+            tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+            leap_warning = timegm(&tm);
+        }
+        delay = (config.delay_min_ms + config.delay_max_ms) / 2000;
+        minute_utc = config.start - config.start % 60;
+        start_minute();
+        // The first sample is at the start of the second config.start
+        second = config.start % 60;
+        second_start = 0;
+        start_second();
+    }
+
+    // Produce the next sample; true is the reduced-carrier state
+    bool next() {
+        double t = sample_count++ * sample_period;
+        while (t >= second_start + 1) {
+            second_start += 1;
+            second++;
+            if (second == (int)seconds_in_minute) {
+                minute_utc += 60;
+                start_minute();
+            }
+            start_second();
+        }
+        if (fade_left > 0)
+            return rng.next() & 1;
+        bool b = t >= reduced_begin && t < reduced_end;
+        if (flip_threshold && rng.next() < flip_threshold)
+            b = !b;
+        return b;
+    }
+
+    // The (true, not local) time of sample k, as UTC seconds.  During a
+    // leap second the result repeats the previous second.
+    double utc_of_sample(uint64_t k) const {
+        double t = config.start + k * sample_period;
+        if (leap_at && t >= leap_at + 1)
+            t -= 1;
+        else if (leap_at && t >= leap_at)
+            t = leap_at - 1e-9;
+        return t;
+    }
+
+    // The fields of the minute currently being transmitted
+    const wwvb_time &current_minute() const { return w; }
+
+    const wwvb_signal_config config;
+    uint64_t sample_count{};
+
+  private:
+    // US DST rules: begins on the 2nd Sunday in March, ends on the 1st Sunday
+    // in November.  WWVB's bits change at 0000 UTC.
+    static int dst_bits(const struct tm &tm) {
+        auto nth_sunday = [&](int mon, int n) {
+            struct tm t = {};
+            t.tm_year = tm.tm_year;
+            t.tm_mon = mon;
+            t.tm_mday = 1;
+            time_t u = timegm(&t);
+            gmtime_r(&u, &t);
+            return 1 + (7 - t.tm_wday) % 7 + 7 * (n - 1);
+        };
+        int begin = nth_sunday(2, 2), end = nth_sunday(10, 1);
+        int mon = tm.tm_mon, mday = tm.tm_mday;
+        if (mon == 2 && mday == begin)
+            return 2;
+        if (mon == 10 && mday == end)
+            return 1;
+        bool in_dst = (mon > 2 || (mon == 2 && mday > begin)) &&
+                      (mon < 10 || (mon == 10 && mday < end));
+        return in_dst ? 3 : 0;
+    }
+
+    void start_minute() {
+        struct tm tm;
+        gmtime_r(&minute_utc, &tm);
+        int y = tm.tm_year + 1900;
+        w = {};
+        w.yday = tm.tm_yday + 1;
+        w.year = y % 100;
+        w.hour = tm.tm_hour;
+        w.minute = tm.tm_min;
+        w.ly = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+        w.dst = dst_bits(tm);
+        w.dut1 = config.dut1;
+        if (leap_at) {
+            if (minute_utc < leap_at)
+                w.dut1 = -4;
+            else
+                w.dut1 = 6;
+            w.ls = minute_utc >= leap_warning && minute_utc < leap_at;
+        }
+        seconds_in_minute = minute_utc + 60 == leap_at ? 61 : 60;
+        wwvb_encode_minute(w, symbols);
+        // The leap second itself is sent as a mark
+        symbols[60] = 2;
+        second = 0;
+    }
+
+    void start_second() {
+        // The phase shift wanders slowly within its limits
+        double lo = config.delay_min_ms / 1000, hi = config.delay_max_ms / 1000;
+        delay += (rng.uniform() - 0.5) * 0.004;
+        delay = delay < lo ? lo : delay > hi ? hi : delay;
+        double rise_jitter = (rng.uniform() - 0.5) * 0.01;
+
+        int sym = symbols[second];
+        double width = sym == 0 ? 0.2 : sym == 1 ? 0.5 : 0.8;
+        reduced_begin = second_start + delay;
+        reduced_end = second_start + width + delay + rise_jitter;
+
+        if (fade_left > 0)
+            fade_left--;
+        if (config.fades_per_hour > 0 &&
+            rng.uniform() < config.fades_per_hour / 3600) {
+            fade_left = 1 + int(-config.fade_seconds * log(1 - rng.uniform()));
+        }
+    }
+
+    wwvb_rng rng;
+    uint64_t flip_threshold;
+    double sample_period;
+    time_t leap_at{}, leap_warning{};
+    time_t minute_utc;
+    wwvb_time w;
+    uint8_t symbols[61];
+    unsigned seconds_in_minute;
+    int second;
+    double second_start, reduced_begin, reduced_end, delay;
+    int fade_left{};
+};
@@ -0,0 +1,134 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// A Linux stand-in for the parts of the Arduino core, the SAMD51 and the
+// SAMDTimerInterrupt library that cwwvb.ino uses, so that the firmware can
+// run on a build machine (see firmware_sim.cpp).  Time is simulated: the
+// driver fires the timer interrupt each time TC3 counts up to its compare
+// register, which runs at TC3_HZ give or take clock_ppm, and digitalRead
+// of the receiver's pin returns its output at that simulated moment, as
+// sampled by the driver beforehand.
+//
+// Interrupts never really preempt anything here.  Instead, the time spent
+// with them masked is recorded, since that is what delays the next one.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+
+#include "instrument.h"
+
+#define LOW (0)
+#define HIGH (1)
+#define INPUT (0)
+#define OUTPUT (1)
+#define INPUT_PULLUP (2)
+#define PIN_LED (13)
+
+struct wwvb_sim_hal {
+    // The timer's nominal clock, 48MHz divided by 16
+    static constexpr double TC3_HZ = 3e6;
+
+    // How fast the board's crystal runs
+    double clock_ppm = 0;
+
+    // The simulated time, in seconds
+    double now = 0;
+
+    // The receiver's output at a given simulated time, and as of now
+    std::function<bool(double)> receiver;
+    int receiver_pin = -1;
+    bool receiver_output = false;
+
+    void (*isr)() = nullptr;
+
+    // Keys waiting to be read from the serial port
+    std::deque<int> serial_in;
+
+    // Set by __WFI(): the main loop has nothing to do
+    bool idle = false;
+
+    // How long interrupts were masked each time, in host nanoseconds
+    wwvb_stage_stats masked;
+    bool interrupts_enabled = true;
+    std::chrono::steady_clock::time_point masked_since;
+
+    static uint32_t ns_since(std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - t)
+            .count();
+    }
+
+    // Simulated seconds from one interrupt to the next, at compare value cc
+    double period(uint32_t cc) const {
+        return cc / (TC3_HZ * (1 + clock_ppm * 1e-6));
+    }
+};
+
+inline wwvb_sim_hal sim_hal;
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int pin) {
+    return pin == sim_hal.receiver_pin && sim_hal.receiver_output;
+}
+
+inline void noInterrupts() {
+    if (sim_hal.interrupts_enabled)
+        sim_hal.masked_since = std::chrono::steady_clock::now();
+    sim_hal.interrupts_enabled = false;
+}
+
+inline void interrupts() {
+    if (!sim_hal.interrupts_enabled)
+        sim_hal.masked.record(sim_hal.ns_since(sim_hal.masked_since));
+    sim_hal.interrupts_enabled = true;
+}
+
+inline void __WFI() { sim_hal.idle = true; }
+
+struct wwvb_sim_serial {
+    void begin(long) {}
+    explicit operator bool() const { return true; }
+    int available() const { return sim_hal.serial_in.size(); }
+    int read() {
+        if (sim_hal.serial_in.empty())
+            return -1;
+        int c = sim_hal.serial_in.front();
+        sim_hal.serial_in.pop_front();
+        return c;
+    }
+};
+
+inline wwvb_sim_serial Serial;
+
+// Just the compare register of the timer/counter
+struct wwvb_sim_tc {
+    struct {
+        struct {
+            uint32_t reg;
+        } CC[2];
+    } COUNT16;
+};
+
+inline wwvb_sim_tc sim_tc3;
+#define TC3 (&sim_tc3)
+
+enum { TIMER_TC3 };
+
+struct SAMDTimer {
+    explicit SAMDTimer(int) {}
+    bool attachInterruptInterval(unsigned long us, void (*handler)()) {
+        sim_hal.isr = handler;
+        TC3->COUNT16.CC[0].reg = us * (wwvb_sim_hal::TC3_HZ / 1e6);
+        return true;
+    }
+};
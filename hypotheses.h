@@ -0,0 +1,221 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Multi-hypothesis tracking of the start of second.  In noise, or for a while
+// after a step in the receiver's delay, the sharpest edge need not be the
+// start of second, and until the statistics settle every symbol the decoder
+// reads is garbage.  Instead, the K sharpest edges are each a hypothesis with
+// a symbol stream of its own, scored by the health of its latest symbols.
+// The symbols and seconds are those of the best scoring stream, which takes
+// over as soon as it scores best.
+//
+// The candidates are found once a second by K passes over the edges, like
+// the decoder's other per-second work, rather than kept as an incremental
+// top K as each sample changes an edge: which edges count depends on those
+// already chosen (no two within NEAR), and O(K * K * SUBSEC) once per
+// SUBSEC samples is O(K * K) per sample.  A new hypothesis's stream is
+// filled in from the samples the decoder still holds, so that it can take
+// over at once rather than after a minute of symbols.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "decoder.h"
+
+template <class Decoder = WWVBDecoder<>, size_t K = 3>
+struct wwvb_hypothesis_decoder {
+    static constexpr size_t SUBSEC = Decoder::SUBSEC;
+    static constexpr size_t SYMBOLS = Decoder::SYMBOLS;
+    static constexpr size_t BUFFER = Decoder::BUFFER;
+    static constexpr auto MAX_HEALTH = Decoder::MAX_HEALTH;
+
+    // A hypothesis is scored by the health of this many of its latest
+    // symbols
+    static constexpr size_t SCORE_SECONDS = 8;
+
+    // Edges this close (in buckets) are the same hypothesis
+    static constexpr int NEAR = 2;
+
+    typedef typename Decoder::symbol_buffer_type symbol_buffer_type;
+
+    struct hypothesis {
+        bool active{};
+        // As in the decoder, relative to dec.subsec
+        uint16_t sos{}, tss{};
+        size_t symbol_count{};
+        int health{}, score{};
+        std::array<uint16_t, SYMBOLS> health_history{};
+        symbol_buffer_type symbols{};
+    };
+
+    // Keeps the statistics, and the samples the symbols are read from
+    Decoder dec;
+
+    std::array<hypothesis, K> hypotheses{};
+    size_t best{};
+
+    // Those of the best hypothesis; use them as the decoder's
+    symbol_buffer_type symbols{};
+    uint16_t sos{};
+    int health{};
+
+    // How many times another hypothesis has taken over
+    size_t promotions{};
+
+    // Receive a sample from the receiver.  Returns true at the START of a
+    // new second of the best hypothesis.  When another hypothesis takes
+    // over, that second may come early or late, but the symbols are always
+    // one hypothesis's own.
+    bool update(bool b) {
+        dec.update(b);
+        bool result = false;
+        for (size_t k = 0; k < K; k++) {
+            auto &y = hypotheses[k];
+            if (!y.active)
+                continue;
+            bool second = false;
+            if (y.tss > SUBSEC)
+                second = true;
+            else if (y.tss > SUBSEC / 2)
+                second = dec.subsec == y.sos;
+            if (second) {
+                y.tss = 0;
+                read_second(y, BUFFER - SUBSEC);
+                result |= chosen(k);
+            } else {
+                y.tss++;
+            }
+        }
+        if (dec.subsec == 0)
+            find_candidates();
+        return result;
+    }
+
+    bool decode_minute(wwvb_time &m) const {
+        auto minute_symbol = [this](int i) {
+            return symbols.at(SYMBOLS - 60 + i);
+        };
+        return wwvb_decode_minute(minute_symbol, m, dec.decode_stats);
+    }
+
+  private:
+    void read_second(hypothesis &y, int offset) {
+        int h;
+        int symbol = dec.read_symbol(offset, h);
+        y.symbols.put(symbol);
+        size_t si = y.symbol_count % SYMBOLS;
+        size_t oi = (y.symbol_count + SYMBOLS - SCORE_SECONDS) % SYMBOLS;
+        y.score += h - y.health_history[oi];
+        y.health += h - y.health_history[si];
+        y.health_history[si] = h;
+        y.symbol_count++;
+    }
+
+    // After hypothesis k reads a second, make it the best if it now scores
+    // best.  Returns whether it is the best.
+    bool chosen(size_t k) {
+        auto &y = hypotheses[k];
+        if (k != best) {
+            if (hypotheses[best].active && y.score <= hypotheses[best].score)
+                return false;
+            best = k;
+            promotions++;
+            symbols = y.symbols;
+        } else {
+            symbols.put(y.symbols.at(SYMBOLS - 1));
+        }
+        sos = y.sos;
+        health = y.health;
+        return true;
+    }
+
+    static int distance(int a, int b) {
+        int d = a > b ? a - b : b - a;
+        return d > int(SUBSEC) / 2 ? SUBSEC - d : d;
+    }
+
+    // Once a second, follow the K sharpest edges: a hypothesis near one
+    // moves to it, and an edge with none near it replaces the lowest scoring
+    // hypothesis near none, other than the best.  At most one hypothesis is
+    // replaced each second, which bounds the cost of filling it in.
+    void find_candidates() {
+        std::array<int, K> peaks;
+        size_t n = 0;
+        for (; n < K; n++) {
+            int bi = -1, peak = 0;
+            for (size_t i = 0; i < SUBSEC; i++) {
+                int s = i == SUBSEC - 1 ? 0 : i + 1;
+                bool taken = false;
+                for (size_t j = 0; j < n; j++)
+                    taken |= distance(s, peaks[j]) <= NEAR;
+                if (!taken && dec.edges[i] > peak) {
+                    bi = s;
+                    peak = dec.edges[i];
+                }
+            }
+            if (bi < 0)
+                break;
+            peaks[n] = bi;
+        }
+
+        std::array<bool, K> matched{};
+        int unmatched_peak = -1;
+        for (size_t j = 0; j < n; j++) {
+            bool found = false;
+            for (size_t k = 0; k < K && !found; k++) {
+                auto &y = hypotheses[k];
+                if (y.active && !matched[k] &&
+                    distance(y.sos, peaks[j]) <= NEAR) {
+                    y.sos = peaks[j];
+                    matched[k] = found = true;
+                }
+            }
+            if (!found && unmatched_peak < 0)
+                unmatched_peak = peaks[j];
+        }
+
+        // A hypothesis which has drifted onto another is redundant
+        for (size_t k = 0; k < K; k++) {
+            auto &y = hypotheses[k];
+            if (!y.active || matched[k] || k == best)
+                continue;
+            for (size_t j = 0; j < K; j++)
+                if (matched[j] && distance(y.sos, hypotheses[j].sos) <= NEAR)
+                    y.active = false;
+        }
+
+        if (unmatched_peak < 0)
+            return;
+        int victim = -1;
+        for (size_t k = 0; k < K; k++) {
+            auto &y = hypotheses[k];
+            if (matched[k] || (k == best && y.active))
+                continue;
+            if (!y.active) {
+                victim = k;
+                break;
+            }
+            if (victim < 0 || y.score < hypotheses[victim].score)
+                victim = k;
+        }
+        if (victim >= 0)
+            start(hypotheses[victim], unmatched_peak);
+    }
+
+    // Begin a hypothesis, filled in with the seconds the decoder still holds
+    void start(hypothesis &y, int s) {
+        y = hypothesis{};
+        y.active = true;
+        y.sos = s;
+        int age = int(dec.subsec) - s;
+        if (age < 0)
+            age += SUBSEC;
+        y.tss = age;
+        for (int offset = (BUFFER - age) % SUBSEC;
+             offset + SUBSEC <= BUFFER - age; offset += SUBSEC)
+            read_second(y, offset);
+    }
+};
@@ -0,0 +1,159 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Optional cycle-count instrumentation of the decoder's stages.  Define
+// WWVB_INSTRUMENT to 1 (consistently, in every translation unit) to enable
+// it; otherwise the stage markers compile to nothing.  The clock and the
+// statistics are always available, for use by measurement tools.
+//
+// The clock source is WWVB_CYCLES(), which defaults to the TSC on x86, the
+// DWT cycle counter on Cortex-M (call wwvb_instrument_init() first), and
+// clock_gettime() nanoseconds elsewhere.  Define WWVB_CYCLES() before
+// including this file to use a different clock.
+
+#pragma once
+
+#ifndef WWVB_INSTRUMENT
+#define WWVB_INSTRUMENT (0)
+#endif
+
+#include <cstdint>
+#include <cstdio>
+
+#ifndef WWVB_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define WWVB_CYCLES() (__rdtsc())
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define WWVB_DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+#define WWVB_CYCLES() (WWVB_DWT_CYCCNT)
+#else
+#include <ctime>
+inline uint64_t wwvb_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#define WWVB_CYCLES() (wwvb_clock_ns())
+#endif
+#endif
+
+// Enable the clock, where that's necessary
+inline void wwvb_instrument_init() {
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    *(volatile uint32_t *)0xE000EDFC |= 1 << 24; // DEMCR.TRCENA
+    WWVB_DWT_CYCCNT = 0;
+    *(volatile uint32_t *)0xE0001000 |= 1; // DWT_CTRL.CYCCNTENA
+#endif
+}
+
+// Distribution of the cost of one stage
+struct wwvb_stage_stats {
+    // bucket i counts durations d with 2^(i-1) <= d < 2^i
+    static constexpr int BUCKETS = 32;
+
+    uint32_t count{}, min{}, max{};
+    uint64_t sum{};
+    uint32_t histogram[BUCKETS]{};
+
+    void record(uint32_t d) {
+        if (!count || d < min)
+            min = d;
+        if (d > max)
+            max = d;
+        count++;
+        sum += d;
+        int b = d ? 32 - __builtin_clz(d) : 0;
+        histogram[b < BUCKETS ? b : BUCKETS - 1]++;
+    }
+
+    uint32_t mean() const { return count ? sum / count : 0; }
+};
+
+// update() is counted both as a whole and by the kind of call: an ordinary
+// sample, or one which concludes a second and so runs decode_symbol.  isr is
+// the whole of the firmware's sampling interrupt, update() included.
+
+#define WWVB_STAGES(X)                                                         \
+    X(update)                                                                  \
+    X(update_sample)                                                           \
+    X(update_second)                                                           \
+    X(counts)                                                                  \
+    X(argmax)                                                                  \
+    X(decode_symbol)                                                           \
+    X(decode_minute)                                                           \
+    X(try_decode)                                                              \
+    X(isr)
+
+enum wwvb_stage {
+#define WWVB_STAGE_ENUM(name) WWVB_STAGE_##name,
+    WWVB_STAGES(WWVB_STAGE_ENUM)
+#undef WWVB_STAGE_ENUM
+        WWVB_STAGE_COUNT
+};
+
+inline const char *const wwvb_stage_names[] = {
+#define WWVB_STAGE_NAME(name) #name,
+    WWVB_STAGES(WWVB_STAGE_NAME)
+#undef WWVB_STAGE_NAME
+};
+
+#if WWVB_INSTRUMENT
+
+inline wwvb_stage_stats wwvb_stage_profile[WWVB_STAGE_COUNT];
+
+inline void wwvb_profile_reset() {
+    for (auto &s : wwvb_stage_profile)
+        s = {};
+}
+
+// Print min/mean/max of each stage that ran, then the non-empty histogram
+// buckets
+inline void
+wwvb_profile_print(FILE *f,
+                   const wwvb_stage_stats *profile = wwvb_stage_profile) {
+    fprintf(f, "%-14s %10s %8s %8s %8s\n", "stage", "count", "min", "mean",
+            "max");
+    for (int i = 0; i < WWVB_STAGE_COUNT; i++) {
+        const auto &s = profile[i];
+        if (!s.count)
+            continue;
+        fprintf(f, "%-14s %10lu %8lu %8lu %8lu\n", wwvb_stage_names[i],
+                (unsigned long)s.count, (unsigned long)s.min,
+                (unsigned long)s.mean(), (unsigned long)s.max);
+        for (int b = 0; b < s.BUCKETS; b++) {
+            if (s.histogram[b])
+                fprintf(f, "    < %-10lu %10lu\n", 1ul << b,
+                        (unsigned long)s.histogram[b]);
+        }
+    }
+}
+
+#define WWVB_STAGE_BEGIN(name) auto wwvb_stage_t0_##name = WWVB_CYCLES()
+#define WWVB_STAGE_END(name)                                                   \
+    wwvb_stage_profile[WWVB_STAGE_##name].record(                              \
+        uint32_t(WWVB_CYCLES() - wwvb_stage_t0_##name))
+// Record the stage as a whole and also as one of two kinds
+#define WWVB_STAGE_END_KIND(name, cond, if_true, if_false)                     \
+    do {                                                                       \
+        auto d = uint32_t(WWVB_CYCLES() - wwvb_stage_t0_##name);               \
+        wwvb_stage_profile[WWVB_STAGE_##name].record(d);                       \
+        wwvb_stage_profile[(cond) ? WWVB_STAGE_##if_true                       \
+                                  : WWVB_STAGE_##if_false]                     \
+            .record(d);                                                        \
+    } while (0)
+
+#else
+
+#define WWVB_STAGE_BEGIN(name)                                                 \
+    do {                                                                       \
+    } while (0)
+#define WWVB_STAGE_END(name)                                                   \
+    do {                                                                       \
+    } while (0)
+#define WWVB_STAGE_END_KIND(name, cond, if_true, if_false)                     \
+    do {                                                                       \
+    } while (0)
+
+#endif
@@ -0,0 +1,322 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// A decoder for N channels that receive their samples in lockstep, such as
+// recordings replayed together.  The counts and edges of all channels are
+// stored interleaved (struct-of-arrays: bucket-major, channel-minor), so one
+// pass over memory updates every channel, using AVX2 or SSE2 vectors of
+// int16 when the compiler targets them and plain loops otherwise.  Each
+// channel decodes exactly what a WWVBDecoder would given its samples.
+//
+// Define WWVB_NO_SIMD to use the portable code on any target.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "decoder.h"
+
+#if !defined(WWVB_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+
+// 16 int16 lanes
+struct wwvb_i16_vector {
+    static constexpr int LANES = 16;
+    __m256i v;
+
+    static wwvb_i16_vector load(const int16_t *p) {
+        return {_mm256_loadu_si256((const __m256i *)p)};
+    }
+    void store(int16_t *p) const { _mm256_storeu_si256((__m256i *)p, v); }
+    static wwvb_i16_vector splat(int16_t x) { return {_mm256_set1_epi16(x)}; }
+
+    // -1 in the lanes whose bit is set, 0 elsewhere
+    static wwvb_i16_vector from_bits(unsigned bits) {
+        const __m256i select =
+            _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024,
+                              2048, 4096, 8192, 16384, -32768);
+        __m256i b = _mm256_and_si256(_mm256_set1_epi16(bits), select);
+        return {_mm256_cmpeq_epi16(b, select)};
+    }
+
+    friend wwvb_i16_vector operator+(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm256_add_epi16(a.v, b.v)};
+    }
+    friend wwvb_i16_vector operator-(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm256_sub_epi16(a.v, b.v)};
+    }
+    friend wwvb_i16_vector max(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm256_max_epi16(a.v, b.v)};
+    }
+    friend wwvb_i16_vector greater(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm256_cmpgt_epi16(a.v, b.v)};
+    }
+    // b in the lanes of mask, a elsewhere
+    friend wwvb_i16_vector select(wwvb_i16_vector mask, wwvb_i16_vector a,
+                                  wwvb_i16_vector b) {
+        return {_mm256_blendv_epi8(a.v, b.v, mask.v)};
+    }
+};
+
+#elif !defined(WWVB_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+
+// 8 int16 lanes
+struct wwvb_i16_vector {
+    static constexpr int LANES = 8;
+    __m128i v;
+
+    static wwvb_i16_vector load(const int16_t *p) {
+        return {_mm_loadu_si128((const __m128i *)p)};
+    }
+    void store(int16_t *p) const { _mm_storeu_si128((__m128i *)p, v); }
+    static wwvb_i16_vector splat(int16_t x) { return {_mm_set1_epi16(x)}; }
+
+    // -1 in the lanes whose bit is set, 0 elsewhere
+    static wwvb_i16_vector from_bits(unsigned bits) {
+        const __m128i select = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+        __m128i b = _mm_and_si128(_mm_set1_epi16(bits), select);
+        return {_mm_cmpeq_epi16(b, select)};
+    }
+
+    friend wwvb_i16_vector operator+(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm_add_epi16(a.v, b.v)};
+    }
+    friend wwvb_i16_vector operator-(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm_sub_epi16(a.v, b.v)};
+    }
+    friend wwvb_i16_vector max(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm_max_epi16(a.v, b.v)};
+    }
+    friend wwvb_i16_vector greater(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {_mm_cmpgt_epi16(a.v, b.v)};
+    }
+    // b in the lanes of mask, a elsewhere
+    friend wwvb_i16_vector select(wwvb_i16_vector mask, wwvb_i16_vector a,
+                                  wwvb_i16_vector b) {
+        return {_mm_or_si128(_mm_and_si128(mask.v, b.v),
+                             _mm_andnot_si128(mask.v, a.v))};
+    }
+};
+
+#else
+
+// The portable version: one lane
+struct wwvb_i16_vector {
+    static constexpr int LANES = 1;
+    int16_t v;
+
+    static wwvb_i16_vector load(const int16_t *p) { return {*p}; }
+    void store(int16_t *p) const { *p = v; }
+    static wwvb_i16_vector splat(int16_t x) { return {x}; }
+    static wwvb_i16_vector from_bits(unsigned bits) {
+        return {int16_t(bits & 1 ? -1 : 0)};
+    }
+
+    friend wwvb_i16_vector operator+(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {int16_t(a.v + b.v)};
+    }
+    friend wwvb_i16_vector operator-(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {int16_t(a.v - b.v)};
+    }
+    friend wwvb_i16_vector max(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {a.v > b.v ? a.v : b.v};
+    }
+    friend wwvb_i16_vector greater(wwvb_i16_vector a, wwvb_i16_vector b) {
+        return {int16_t(a.v > b.v ? -1 : 0)};
+    }
+    friend wwvb_i16_vector select(wwvb_i16_vector mask, wwvb_i16_vector a,
+                                  wwvb_i16_vector b) {
+        return {mask.v ? b.v : a.v};
+    }
+};
+
+#endif
+
+template <size_t N, size_t SUBSEC_ = 50, size_t SYMBOLS_ = 60,
+          size_t HISTORY_ = 40>
+struct MultichannelWWVBDecoder {
+    typedef WWVBDecoder<SUBSEC_, SYMBOLS_, HISTORY_> scalar_type;
+    typedef wwvb_i16_vector vector;
+
+    static constexpr size_t CHANNELS = N;
+    static constexpr size_t SUBSEC = SUBSEC_;
+    static constexpr size_t SYMBOLS = SYMBOLS_;
+    static constexpr size_t HISTORY = HISTORY_;
+    static constexpr size_t BUFFER = SUBSEC * HISTORY;
+    static constexpr size_t WORDS = (N + 63) / 64;
+
+    static_assert(N % 16 == 0, "channels come in groups of 16");
+
+    static constexpr auto p0 = scalar_type::p0, p1 = scalar_type::p1,
+                          p2 = scalar_type::p2, p3 = scalar_type::p3,
+                          p4 = scalar_type::p4;
+    static constexpr auto la = scalar_type::la, lb = scalar_type::lb,
+                          lc = scalar_type::lc, ld = scalar_type::ld;
+
+    typedef std::array<uint64_t, WORDS> channel_mask;
+
+    // Total number of samples ever received
+    size_t sample_count{};
+
+    // subsec counts the position modulo SUBSEC; pos is where the next sample
+    // goes in signal
+    uint16_t subsec{}, pos{};
+
+    // Statistical information about the raw samples: counts[i][c] is bucket
+    // i of channel c
+    alignas(32) std::array<std::array<int16_t, N>, SUBSEC> counts{};
+    alignas(32) std::array<std::array<int16_t, N>, SUBSEC> edges{};
+
+    // The start-of-second and time in ticks since the last second of each
+    // channel
+    std::array<uint16_t, N> sos{}, tss{};
+
+    // The channels at the start of a new WWVB second after the latest sample
+    channel_mask seconds{};
+
+    // Raw samples from the receivers, bit c for channel c
+    std::array<channel_mask, BUFFER> signal{};
+
+    // The symbols of each channel
+    struct channel_state {
+        size_t symbol_count{};
+        int health{};
+        typename scalar_type::health_history_type health_history{};
+        typename scalar_type::symbol_buffer_type symbols{};
+    };
+    std::array<channel_state, N> channels{};
+
+    static unsigned bits_at(const channel_mask &m, size_t c) {
+        return unsigned(m[c / 64] >> (c % 64));
+    }
+
+    // Receive one sample for each channel (bit c%64 of b[c/64] for channel
+    // c).  Returns true if any channel is at the START of a new WWVB second,
+    // and which ones are in seconds.
+    bool update(const uint64_t *b) {
+        sample_count++;
+        channel_mask ob = signal[pos];
+        auto &nb = signal[pos];
+        for (size_t w = 0; w < WORDS; w++)
+            nb[w] = b[w];
+        pos = pos == BUFFER - 1 ? 0 : pos + 1;
+
+        // Update the counts and edges arrays.  Set bits become -1, so the
+        // change in count is old minus new.
+        auto subsec1 = subsec == SUBSEC - 1 ? 0 : subsec + 1;
+        auto &count = counts[subsec];
+        for (size_t c = 0; c < N; c += vector::LANES) {
+            auto delta = vector::from_bits(bits_at(ob, c)) -
+                         vector::from_bits(bits_at(nb, c));
+            auto n = vector::load(&count[c]) + delta;
+            n.store(&count[c]);
+            (vector::load(&counts[subsec1][c]) - n).store(&edges[subsec][c]);
+        }
+
+        // Find every channel's sharpest edge in one pass over the edges
+        constexpr size_t V = N / vector::LANES;
+        vector best[V], index[V];
+        for (size_t v = 0; v < V; v++)
+            best[v] = index[v] = vector::splat(0);
+        for (size_t i = 0; i < SUBSEC; i++) {
+            auto iv = vector::splat(i);
+            for (size_t v = 0; v < V; v++) {
+                auto e = vector::load(&edges[i][v * vector::LANES]);
+                index[v] = select(greater(e, best[v]), index[v], iv);
+                best[v] = max(best[v], e);
+            }
+        }
+        alignas(32) std::array<int16_t, N> bi;
+        for (size_t v = 0; v < V; v++)
+            index[v].store(&bi[v * vector::LANES]);
+
+        subsec = subsec1;
+
+        bool any = false;
+        seconds = {};
+        for (size_t c = 0; c < N; c++) {
+            int osos = sos[c];
+            sos[c] = bi[c] == int(SUBSEC) - 1 ? 0 : bi[c] + 1;
+            bool result = false;
+            if (tss[c] > SUBSEC) {
+                result = true;
+            } else if (tss[c] > SUBSEC / 2) {
+                result = subsec == sos[c] || subsec == osos;
+            }
+            if (result) {
+                tss[c] = 0;
+                seconds[c / 64] |= uint64_t{1} << (c % 64);
+                decode_symbol(c);
+                any = true;
+            } else {
+                tss[c]++;
+            }
+        }
+        return any;
+    }
+
+    // Return how many of the samples i..j of the latest second of channel c
+    // are true
+    int count(size_t c, int i, int j) const {
+        int result = 0;
+        size_t k = pos + BUFFER - SUBSEC + i;
+        for (; i < j; i++, k++)
+            result += signal[k % BUFFER][c / 64] >> (c % 64) & 1;
+        return result;
+    }
+
+    static int check_health(int count, int length, int expect) {
+        return expect ? count : length - count;
+    }
+
+    // A second just concluded in channel c
+    void decode_symbol(size_t c) {
+        int count_a = count(c, p0, p1);
+        int count_b = count(c, p1, p2);
+        int count_c = count(c, p2, p3);
+        int count_d = count(c, p3, p4);
+
+        int result = 0;
+        if (count_c > lc / 2) {
+            if (count_b > lb / 2) {
+                result = 2;
+            } else {
+                result = 3; // a nonsense symbol
+            }
+        } else if (count_b > lb / 2) {
+            result = 1;
+        }
+
+        int h = 0;
+        if (result != 3) {
+            h += check_health(count_a, la, 1);
+            h += check_health(count_b, lb, result != 0);
+            h += check_health(count_c, lc, result == 2);
+            h += check_health(count_d, ld, 0);
+        }
+
+        auto &ch = channels[c];
+        int si = ch.symbol_count++ % SYMBOLS;
+        int oh = exchange_health(ch.health_history, si, h);
+        ch.health += h - oh;
+        ch.symbols.put(result);
+    }
+
+    bool at_second(size_t c) const { return seconds[c / 64] >> (c % 64) & 1; }
+
+    int health(size_t c) const { return channels[c].health; }
+
+    int symbol(size_t c, int i) const { return channels[c].symbols.at(i); }
+
+    bool decode_minute(size_t c, wwvb_time &m) const {
+        const auto &symbols = channels[c].symbols;
+        auto minute_symbol = [&](int i) {
+            return symbols.at(SYMBOLS - 60 + i);
+        };
+        wwvb_no_decode_stats stats;
+        return wwvb_decode_minute(minute_symbol, m, stats);
+    }
+};
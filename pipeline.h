@@ -0,0 +1,212 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Building blocks for the host decoder's pipeline: a bounded
+// single-producer/single-consumer ring, lock-free unless one side has to
+// sleep, and the blocks that travel through it.  Each pipeline stage runs on
+// its own thread:
+//
+//   reader --raw_block--> unpacker --sample_block--> decoder
+//          --minute_record--> formatter
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Where a thread that has spun for a while without making progress sleeps
+// until another thread wakes it.  Waking costs a fence and a load unless
+// someone is asleep.
+struct idle_waiter {
+    // Called on each failed attempt: spin, then yield, then sleep until
+    // ready() (or a wake, which is then retried)
+    template <class F> void wait(int spins, F &&ready) {
+        if (spins < 64)
+            return;
+        if (spins < 128) {
+            std::this_thread::yield();
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers.fetch_add(1, std::memory_order_relaxed);
+        // Pairs with the fence in wake(): either ready() sees the progress,
+        // or wake() sees the sleeper
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv.wait(lock, ready);
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Called after making progress that a sleeper may be waiting for
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cv.notify_all();
+        }
+    }
+
+  private:
+    std::atomic<int> sleepers{};
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+// A bounded ring with exactly one producing and one consuming thread.  N
+// must be a power of two.  The producer calls close() after its last push;
+// pop() then fails once the ring has drained.  push() and pop() sleep when
+// the ring stays full or empty.
+template <class T, size_t N> struct spsc_ring {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+    bool try_push(const T &v) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h - tail_cache == N) {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h - tail_cache == N)
+                return false;
+        }
+        slots[h % N] = v;
+        head.store(h + 1, std::memory_order_release);
+        waiter.wake();
+        return true;
+    }
+
+    bool try_pop(T &v) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t == head_cache) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t == head_cache)
+                return false;
+        }
+        v = slots[t % N];
+        tail.store(t + 1, std::memory_order_release);
+        waiter.wake();
+        return true;
+    }
+
+    void push(const T &v) {
+        for (int spins = 0; !try_push(v); spins++)
+            waiter.wait(spins, [this] {
+                return head.load(std::memory_order_relaxed) -
+                           tail.load(std::memory_order_acquire) !=
+                       N;
+            });
+    }
+
+    // Returns false when the ring is closed and empty
+    bool pop(T &v) {
+        for (int spins = 0; !try_pop(v); spins++) {
+            if (closed.load(std::memory_order_acquire)) {
+                // A push may have landed between the failed try and close
+                return try_pop(v);
+            }
+            waiter.wait(spins, [this] {
+                return !empty() || closed.load(std::memory_order_acquire);
+            });
+        }
+        return true;
+    }
+
+    void close() {
+        closed.store(true, std::memory_order_release);
+        waiter.wake();
+    }
+
+    // For the consumer: nothing to pop just now
+    bool empty() const {
+        return tail.load(std::memory_order_relaxed) ==
+               head.load(std::memory_order_acquire);
+    }
+
+  private:
+    // Producer-owned and consumer-owned indices live on separate cache lines
+    alignas(64) std::atomic<size_t> head{};
+    size_t tail_cache{};
+    alignas(64) std::atomic<size_t> tail{};
+    size_t head_cache{};
+    alignas(64) std::atomic<bool> closed{};
+    idle_waiter waiter;
+    T slots[N];
+};
+
+// Bytes as read from the input
+struct raw_block {
+    static constexpr size_t SIZE = 65536;
+    size_t len;
+    unsigned char data[SIZE];
+};
+
+// Samples packed 64 per word, oldest sample in the least significant bit.
+// A set bit is the reduced-carrier state.
+struct sample_block {
+    static constexpr size_t WORDS = 64;
+    static constexpr size_t SIZE = WORDS * 64;
+    size_t len;
+    uint64_t bits[WORDS];
+
+    bool at(size_t i) const { return (bits[i / 64] >> (i % 64)) & 1; }
+};
+
+enum class input_format {
+    ascii,  // '_' is reduced carrier, '#' is full carrier, all else ignored
+    packed, // 8 samples per byte, oldest in the least significant bit
+};
+
+// Converts raw_blocks into sample_blocks, which may straddle raw_blocks
+struct sample_unpacker {
+    explicit sample_unpacker(input_format fmt) : fmt(fmt) { cur.len = 0; }
+
+    // Calls emit(const sample_block &) for every block that fills up
+    template <class F> void feed(const raw_block &raw, F &&emit) {
+        if (fmt == input_format::packed) {
+            for (size_t i = 0; i < raw.len; i++) {
+                uint64_t byte = raw.data[i];
+                size_t w = cur.len / 64, b = cur.len % 64;
+                if (b == 0)
+                    cur.bits[w] = 0;
+                cur.bits[w] |= byte << b;
+                cur.len += 8;
+                if (cur.len == sample_block::SIZE) {
+                    emit(cur);
+                    cur.len = 0;
+                }
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < raw.len; i++) {
+            auto c = raw.data[i];
+            if (c != '_' && c != '#')
+                continue;
+            size_t w = cur.len / 64, b = cur.len % 64;
+            if (b == 0)
+                cur.bits[w] = 0;
+            cur.bits[w] |= uint64_t(c == '_') << b;
+            if (++cur.len == sample_block::SIZE) {
+                emit(cur);
+                cur.len = 0;
+            }
+        }
+    }
+
+    // Emits the final, partial block
+    template <class F> void finish(F &&emit) {
+        if (cur.len)
+            emit(cur);
+        cur.len = 0;
+    }
+
+    input_format fmt;
+    sample_block cur;
+};
+
+// Rings are too large for the stack
+template <class T, size_t N> std::unique_ptr<spsc_ring<T, N>> make_ring() {
+    return std::unique_ptr<spsc_ring<T, N>>(new spsc_ring<T, N>());
+}
@@ -0,0 +1,212 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// A pool of decoders for many receivers, each known by a numeric id.  Every
+// receiver belongs to one shard, chosen by its id, and each shard is a thread
+// (pinned to a core, where possible) which owns the decoders of its
+// receivers.  Sample blocks, and the adding and removing of receivers, travel
+// to the shards over spsc_rings, so nothing on the sample path takes a lock
+// or touches another shard's decoders.  Decoded minutes come back over one
+// ring per shard, which pop() drains in turn as a single queue, sleeping
+// while all of them stay empty.
+//
+// One thread adds, removes and submits; one other thread pops.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#include "decoder.h"
+#include "pipeline.h"
+#include "sink.h"
+
+// A decoded minute and the receiver it came from.  minute.sample counts that
+// receiver's samples.
+struct wwvb_pool_record {
+    uint32_t receiver;
+    minute_record minute;
+};
+
+template <class Decoder = WWVBDecoder<>, size_t INBOUND = 64,
+          size_t OUTBOUND = 1024>
+struct wwvb_decoder_pool {
+    explicit wwvb_decoder_pool(unsigned count = 0) {
+        if (!count)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        shards.resize(count);
+        running = count;
+        for (unsigned i = 0; i < count; i++) {
+            auto &s = shards[i];
+            s.reset(new shard);
+            s->thread = std::thread([this, i] { run(*shards[i]); });
+            pin(s->thread, i);
+        }
+    }
+
+    ~wwvb_decoder_pool() {
+        close();
+        for (auto &s : shards)
+            s->thread.join();
+    }
+
+    wwvb_decoder_pool(const wwvb_decoder_pool &) = delete;
+    wwvb_decoder_pool &operator=(const wwvb_decoder_pool &) = delete;
+
+    unsigned shard_of(uint32_t receiver) const {
+        // Consecutive ids spread across the shards
+        return (receiver * 2654435761u) % shards.size();
+    }
+
+    // A receiver's samples begin with the first block submitted after it is
+    // added.  Blocks for unknown receivers are dropped.
+    void add(uint32_t receiver) { send(message::add, receiver, nullptr); }
+    void remove(uint32_t receiver) { send(message::remove, receiver, nullptr); }
+    void submit(uint32_t receiver, const sample_block &block) {
+        send(message::samples, receiver, &block);
+    }
+
+    // No more messages; the shards finish their queued work and stop
+    void close() {
+        if (closed)
+            return;
+        closed = true;
+        for (auto &s : shards)
+            s->inbound.close();
+    }
+
+    bool try_pop(wwvb_pool_record &r) {
+        for (size_t k = 0; k < shards.size(); k++) {
+            auto &s = *shards[next];
+            next = next + 1 == shards.size() ? 0 : next + 1;
+            if (s.outbound.try_pop(r))
+                return true;
+        }
+        return false;
+    }
+
+    // Returns false once the pool is closed and every minute has been popped
+    bool pop(wwvb_pool_record &r) {
+        for (int spins = 0; !try_pop(r); spins++) {
+            if (!running.load(std::memory_order_acquire))
+                return try_pop(r);
+            minutes.wait(spins, [this] { return ready(); });
+        }
+        return true;
+    }
+
+  private:
+    // Something to pop, or nothing more to come
+    bool ready() const {
+        if (!running.load(std::memory_order_acquire))
+            return true;
+        for (auto &s : shards)
+            if (!s->outbound.empty())
+                return true;
+        return false;
+    }
+
+    struct message {
+        enum kind_type : uint8_t { samples, add, remove } kind;
+        uint32_t receiver;
+        sample_block block;
+    };
+
+    struct receiver_state {
+        Decoder dec;
+        uint64_t samples{};
+    };
+
+    struct shard {
+        spsc_ring<message, INBOUND> inbound;
+        spsc_ring<wwvb_pool_record, OUTBOUND> outbound;
+        std::thread thread;
+    };
+
+    void send(typename message::kind_type kind, uint32_t receiver,
+              const sample_block *block) {
+        // The message is large, so it is built in place rather than on the
+        // stack of every call
+        m.kind = kind;
+        m.receiver = receiver;
+        if (block) {
+            m.block.len = block->len;
+            std::copy(block->bits, block->bits + (block->len + 63) / 64,
+                      m.block.bits);
+        }
+        shards[shard_of(receiver)]->inbound.push(m);
+    }
+
+    void run(shard &s) {
+        std::unordered_map<uint32_t, std::unique_ptr<receiver_state>>
+            receivers;
+        std::unique_ptr<message> in(new message);
+        while (s.inbound.pop(*in)) {
+            switch (in->kind) {
+            case message::add:
+                receivers[in->receiver].reset(new receiver_state);
+                break;
+            case message::remove:
+                receivers.erase(in->receiver);
+                break;
+            case message::samples: {
+                auto it = receivers.find(in->receiver);
+                if (it != receivers.end())
+                    decode(s, in->receiver, *it->second, in->block);
+                break;
+            }
+            }
+        }
+        s.outbound.close();
+        running.fetch_sub(1, std::memory_order_release);
+        minutes.wake();
+    }
+
+    void decode(shard &s, uint32_t receiver, receiver_state &r,
+                       const sample_block &block) {
+        auto &dec = r.dec;
+        for (size_t j = 0; j < block.len; j++, r.samples++) {
+            if (!dec.update(block.at(j)))
+                continue;
+            wwvb_time m;
+            if (dec.symbols.at(dec.SYMBOLS - 1) == 2 &&
+                dec.decode_minute(m)) {
+                s.outbound.push(
+                    {receiver, minute_record::make(dec, m, r.samples)});
+                minutes.wake();
+            }
+        }
+    }
+
+    static void pin(std::thread &t, unsigned i) {
+#ifdef __linux__
+        unsigned cores = std::thread::hardware_concurrency();
+        if (!cores)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(i % cores, &set);
+        pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+        (void)t;
+        (void)i;
+#endif
+    }
+
+    std::vector<std::unique_ptr<shard>> shards;
+    std::atomic<unsigned> running{};
+    // Where pop() sleeps; woken by each minute and each shard that stops
+    idle_waiter minutes;
+    bool closed{};
+    size_t next{};
+    message m;
+};
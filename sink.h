@@ -0,0 +1,223 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Host-side output of decoded minutes.  Records are formatted into a large
+// buffer and handed to the kernel in big writes, rather than going through
+// per-line stdio.
+
+#pragma once
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+#include "decoder.h"
+
+// Collects output in a buffer and issues write(2) only when it fills up
+struct buffered_writer {
+    static constexpr size_t SIZE = 1 << 20;
+
+    explicit buffered_writer(int fd) : fd(fd), buf(new char[SIZE]) {}
+    ~buffered_writer() {
+        flush();
+        delete[] buf;
+    }
+    buffered_writer(const buffered_writer &) = delete;
+    buffered_writer &operator=(const buffered_writer &) = delete;
+
+    void write(const void *data, size_t n) {
+        if (len + n > SIZE)
+            flush();
+        if (n > SIZE) {
+            write_all(static_cast<const char *>(data), n);
+            return;
+        }
+        memcpy(buf + len, data, n);
+        len += n;
+    }
+
+    // Format directly into the buffer; a single record never exceeds
+    // RECORD_MAX bytes
+    __attribute__((format(printf, 2, 3))) void printf(const char *fmt, ...) {
+        constexpr size_t RECORD_MAX = 512;
+        if (len + RECORD_MAX > SIZE)
+            flush();
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf + len, RECORD_MAX, fmt, ap);
+        va_end(ap);
+        if (n > 0)
+            len += (size_t)n < RECORD_MAX ? n : RECORD_MAX - 1;
+    }
+
+    void flush() {
+        write_all(buf, len);
+        len = 0;
+    }
+
+    bool failed() const { return error; }
+
+  private:
+    void write_all(const char *p, size_t n) {
+        while (n && !error) {
+            ssize_t r = ::write(fd, p, n);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                error = true;
+                break;
+            }
+            p += r;
+            n -= r;
+        }
+    }
+
+    int fd;
+    char *buf;
+    size_t len{};
+    bool error{};
+};
+
+// One decoded minute.  This is also the layout of the `binary` output
+// format: 32 bytes, host byte order, one record per decoded minute.  The
+// maximum health is symbols * subsec.
+struct minute_record {
+    uint64_t sample; // index of the sample that concluded the minute
+    int64_t utc;     // start of the decoded minute, seconds since the epoch
+    uint16_t health;
+    uint16_t sos;
+    uint16_t subsec; // samples per second
+    int16_t yday;
+    int8_t year, hour, minute, ls, ly, dst, dut1;
+    uint8_t symbols; // the decoder's SYMBOLS, over which health is summed
+
+    template <class Decoder>
+    static minute_record make(const Decoder &dec, const wwvb_time &m,
+                              uint64_t sample) {
+        static_assert(Decoder::SYMBOLS <= UINT8_MAX,
+                      "SYMBOLS must fit in minute_record::symbols");
+        static_assert(Decoder::SYMBOLS * Decoder::SUBSEC <= UINT16_MAX,
+                      "the maximum health must fit in minute_record::health");
+        minute_record r{};
+        r.sample = sample;
+        r.utc = m.to_utc();
+        r.health = dec.health;
+        r.sos = dec.sos;
+        r.subsec = dec.SUBSEC;
+        r.symbols = dec.SYMBOLS;
+        r.yday = m.yday;
+        r.year = m.year;
+        r.hour = m.hour;
+        r.minute = m.minute;
+        r.ls = m.ls;
+        r.ly = m.ly;
+        r.dst = m.dst;
+        r.dut1 = m.dut1;
+        return r;
+    }
+
+    wwvb_time time() const {
+        wwvb_time m{};
+        m.yday = yday;
+        m.year = year;
+        m.hour = hour;
+        m.minute = minute;
+        m.ls = ls;
+        m.ly = ly;
+        m.dst = dst;
+        m.dut1 = dut1;
+        return m;
+    }
+
+    int max_health() const { return symbols * subsec; }
+};
+static_assert(sizeof(minute_record) == 32);
+
+enum class output_format { text, csv, jsonl, binary };
+
+inline bool parse_output_format(const char *name, output_format &fmt) {
+    static const struct {
+        const char *name;
+        output_format fmt;
+    } names[] = {{"text", output_format::text},
+                 {"csv", output_format::csv},
+                 {"jsonl", output_format::jsonl},
+                 {"binary", output_format::binary}};
+    for (const auto &n : names) {
+        if (!strcmp(name, n.name)) {
+            fmt = n.fmt;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Formats minute_records onto a buffered_writer
+struct output_sink {
+    output_sink(buffered_writer &out, output_format fmt) : out(out), fmt(fmt) {}
+
+    void begin() {
+        if (fmt == output_format::csv) {
+            out.printf("sample,seconds,utc,time,year,yday,hour,minute,ls,ly,"
+                       "dst,dut1,health,max_health,sos\n");
+        }
+    }
+
+    void minute(const minute_record &r) {
+        double seconds = (double)r.sample / r.subsec;
+        char iso[24];
+        time_t t = r.utc;
+        struct tm tt;
+        gmtime_r(&t, &tt);
+
+        switch (fmt) {
+        case output_format::text: {
+            auto m = r.time();
+            out.printf("[%7.2f] %4d-%02d-%02d %2d:%02d %d %d\n", seconds,
+                       1900 + tt.tm_year, tt.tm_mon + 1, tt.tm_mday,
+                       tt.tm_hour, tt.tm_min, m.ly, m.dst);
+            tt = m.apply_zone_and_dst(6, true);
+            out.printf("          %4d-%02d-%02d %2d:%02d\n", 1900 + tt.tm_year,
+                       tt.tm_mon + 1, tt.tm_mday, tt.tm_hour, tt.tm_min);
+            out.printf("          %4d-%03d   %2d:%02d\n", m.year + 2000,
+                       m.yday, m.hour, m.minute);
+            out.printf("Health %4d / %d (%5.2f%%)\n", r.health, r.max_health(),
+                       r.health * 100. / r.max_health());
+        } break;
+
+        case output_format::csv:
+            strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%SZ", &tt);
+            out.printf("%llu,%.2f,%lld,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+                       (unsigned long long)r.sample, seconds,
+                       (long long)r.utc, iso, r.year + 2000, r.yday, r.hour,
+                       r.minute, r.ls, r.ly, r.dst, r.dut1, r.health,
+                       r.max_health(), r.sos);
+            break;
+
+        case output_format::jsonl:
+            strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%SZ", &tt);
+            out.printf("{\"sample\":%llu,\"seconds\":%.2f,\"utc\":%lld,"
+                       "\"time\":\"%s\",\"year\":%d,\"yday\":%d,\"hour\":%d,"
+                       "\"minute\":%d,\"ls\":%d,\"ly\":%d,\"dst\":%d,"
+                       "\"dut1\":%d,\"health\":%d,\"max_health\":%d,"
+                       "\"sos\":%d}\n",
+                       (unsigned long long)r.sample, seconds,
+                       (long long)r.utc, iso, r.year + 2000, r.yday, r.hour,
+                       r.minute, r.ls, r.ly, r.dst, r.dut1, r.health,
+                       r.max_health(), r.sos);
+            break;
+
+        case output_format::binary:
+            out.write(&r, sizeof(r));
+            break;
+        }
+    }
+
+    buffered_writer &out;
+    output_format fmt;
+};
@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Handing the decoder's state from the sampling interrupt to the main loop.
+// Once a second the interrupt captures just what the main loop uses (the
+// symbols, counts and edges, and a few figures) into one of two buffers and
+// publishes it under a sequence counter.  The main loop copies the
+// published buffer without masking interrupts, and checks the counter
+// afterwards: the capture is only ever written into the other buffer, so the
+// copy can only be torn if two more captures began meanwhile, and then it
+// is simply taken again.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "decoder.h"
+
+// One writer, which may interrupt the reader (but not the other way round)
+// or run on another thread; one reader
+template <class T> struct wwvb_seqlock {
+    // The buffer to fill in for the next publication
+    T &next() {
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return buf[(s / 2 + 1) & 1];
+    }
+
+    // Publish what was filled in
+    void commit() {
+        seq.store(seq.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+    }
+
+    // Copy the latest publication; false if it was torn by the writer
+    bool try_read(T &out) const {
+        uint32_t s = seq.load(std::memory_order_acquire);
+        out = buf[(s / 2) & 1];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) - (s & ~1u) <= 2;
+    }
+
+    void read(T &out) const {
+        while (!try_read(out)) {
+        }
+    }
+
+    // Each publication adds 2; odd while one is being filled in
+    std::atomic<uint32_t> seq{};
+    T buf[2]{};
+};
+
+// What the firmware's main loop needs of a (non-compact) decoder each second
+template <class Decoder> struct wwvb_decoder_snapshot {
+    static constexpr size_t SUBSEC = Decoder::SUBSEC;
+    static constexpr size_t SYMBOLS = Decoder::SYMBOLS;
+    static constexpr size_t BUFFER = Decoder::BUFFER;
+    static constexpr auto MAX_HEALTH = Decoder::MAX_HEALTH;
+    static constexpr auto HEALTH_97PCT = Decoder::HEALTH_97PCT;
+
+    typename Decoder::symbol_buffer_type symbols;
+    std::array<typename Decoder::count_type, SUBSEC> counts, edges;
+    size_t sample_count;
+    int health;
+    uint16_t sos;
+    int32_t fine_sos;
+    int quality, sharpness;
+    // Acquisitions and losses of lock; see wwvb_lock_stats
+    uint32_t acquisitions, holdovers;
+
+    void capture(const Decoder &dec) {
+        symbols = dec.symbols;
+        counts = dec.counts;
+        edges = dec.edges;
+        sample_count = dec.sample_count;
+        health = dec.health;
+        sos = dec.sos;
+        fine_sos = dec.sos_q8();
+        quality = dec.quality_pct();
+        sharpness = dec.sharpness_pct();
+        acquisitions = dec.lock.acquisition.count;
+        holdovers = dec.lock.holdover.count;
+    }
+
+    // As of the capture; see WWVBDecoder
+    int32_t sos_q8() const { return fine_sos; }
+    int quality_pct() const { return quality; }
+    int sharpness_pct() const { return sharpness; }
+
+    // Decode the captured symbols.  The stats belong to the reader, since
+    // the interrupt never touches them.
+    template <class Stats>
+    bool decode_minute(wwvb_time &m, Stats &stats) const {
+        WWVB_STAGE_BEGIN(decode_minute);
+        auto minute_symbol = [this](int i) {
+            return symbols.at(SYMBOLS - 60 + i);
+        };
+        bool result = wwvb_decode_minute(minute_symbol, m, stats);
+        WWVB_STAGE_END(decode_minute);
+        return result;
+    }
+};
@@ -7,7 +7,32 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "any_decoder.h"
+#include "bitslice.h"
+#include "decimator.h"
 #include "decoder.h"
+#include "decompress.h"
+#include "diversity.h"
+#include "generator.h"
+#include "hypotheses.h"
+#include "multichannel.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "sink.h"
+#include "snapshot.h"
 
 circular_bit_array<6> cba;
 circular_symbol_array<6, 4> csa;
@@ -35,6 +60,21 @@ TEST_CASE("test bit array") {
     CHECK(cba.at(5) == 0);
 }
 
+TEST_CASE("test bit array wraparound") {
+    circular_bit_array<40> a;
+    for (int i = 0; i < 40; i++)
+        a.put(i == 0);
+    // Every rotation must find the single set bit in the right place
+    for (int i = 0; i < 40; i++) {
+        CHECK(a.at((40 - i) % 40));
+        int set = 0;
+        for (int j = 0; j < 40; j++)
+            set += a.at(j);
+        CHECK(set == 1);
+        a.put(a.at(0));
+    }
+}
+
 TEST_CASE("test symbol array") {
     for (int i = 0; i < 6; i++)
         csa.put(0);
@@ -143,4 +183,948 @@ TEST_CASE("test new year") {
     CHECK(ww.year == 2);
     CHECK(ww.yday == 1);
 }
+
+TEST_CASE("test generator round trip") {
+    wwvb_signal_config config;
+    REQUIRE(parse_utc("2016-12-31T23:56:30Z", config.start));
+    REQUIRE(parse_utc("2016-12-31", config.leap_second_day));
+    config.flip_probability = .01;
+    config.seed = 42;
+
+    wwvb_signal_generator gen(config), again(config);
+    WWVBDecoder<> dec;
+    int minutes = 0, mismatches = 0;
+    time_t expect = 1483228620; // 2016-12-31T23:57:00Z
+    for (int i = 0; i < 6 * 60 * 50; i++) {
+        bool b = gen.next();
+        mismatches += b != again.next();
+        wwvb_time m;
+        if (dec.update(b) && dec.symbols.at(dec.SYMBOLS - 1) == 2 &&
+            dec.decode_minute(m)) {
+            CHECK(m.to_utc() == expect);
+            CHECK(m.ls == (expect < 1483228800));
+            CHECK(m.dut1 == (expect < 1483228800 ? -4 : 6));
+            expect += 60;
+            minutes++;
+        }
+    }
+    // 23:57, 23:58, 23:59 (with its leap second), 00:00, 00:01
+    CHECK(minutes == 5);
+    CHECK(mismatches == 0);
+
+    uint8_t sym[60];
+    wwvb_time w = {.yday = 73, .year = 21, .hour = 7, .minute = 30, .dst = 2};
+    wwvb_encode_minute(w, sym);
+    CHECK(sym[0] == 2);
+    CHECK(sym[59] == 2);
+    CHECK(sym[57] == 1);
+    CHECK(sym[58] == 0);
+}
+
+TEST_CASE("test decode failure reasons") {
+    wwvb_time w = {.yday = 311, .year = 21, .hour = 6, .minute = 32, .dst = 1};
+    w.dut1 = -3;
+    uint8_t good[60];
+    wwvb_encode_minute(w, good);
+
+    WWVBDecoder<> dec;
+    auto attempt = [&](int pos, int value) {
+        uint8_t sym[60];
+        memcpy(sym, good, sizeof(sym));
+        if (pos >= 0)
+            sym[pos] = value;
+        for (auto s : sym)
+            dec.symbols.put(s);
+        wwvb_time m;
+        return dec.decode_minute(m);
+    };
+    const auto &st = dec.decode_stats;
+
+    CHECK(attempt(-1, 0));
+    CHECK(st.count[st.ok] == 1);
+    CHECK(st.failures() == 0);
+
+    CHECK(!attempt(19, 0));
+    CHECK(st.last_reason == st.mark);
+    CHECK(st.last_symbol == 19);
+
+    CHECK(!attempt(24, 1));
+    CHECK(st.last_reason == st.zero);
+    CHECK(st.last_symbol == 24);
+
+    // Minute units of 8 + 2 = 10
+    CHECK(!attempt(5, 1));
+    CHECK(st.last_reason == st.bcd);
+    CHECK(st.last_symbol == 8);
+
+    CHECK(!attempt(37, 0));
+    CHECK(st.last_reason == st.dut1_sign);
+
+    // Not framed like a minute, so not counted
+    CHECK(!attempt(0, 0));
+    CHECK(st.failures() == 4);
+    CHECK(st.count[st.mark] == 1);
+}
+
+TEST_CASE("test signal quality") {
+    auto run = [](double noise) {
+        wwvb_signal_config config;
+        config.start = 1636200000;
+        config.flip_probability = noise;
+        wwvb_signal_generator gen(config);
+        WWVBDecoder<> dec;
+        for (int i = 0; i < 3 * 60 * 50; i++) {
+            dec.update(gen.next());
+            // Compare the incremental sums with sums from scratch
+            wwvb_signal_quality q{};
+            for (int j = 0; j < (int)dec.SUBSEC; j++) {
+                int e = dec.edges[j] > 0 ? dec.edges[j] : 0;
+                int k = dec.quality_bucket(j);
+                q.edge_energy += e;
+                q.near_energy += dec.near_sos(k) ? e : 0;
+                q.count_a += k < dec.p1 ? dec.counts[j] : 0;
+                q.count_d += k >= dec.p3 ? dec.counts[j] : 0;
+            }
+            REQUIRE(q.edge_energy == dec.quality.edge_energy);
+            REQUIRE(q.near_energy == dec.quality.near_energy);
+            REQUIRE(q.count_a == dec.quality.count_a);
+            REQUIRE(q.count_d == dec.quality.count_d);
+        }
+        return std::make_pair(dec.quality_pct(), dec.sharpness_pct());
+    };
+    auto clean = run(0), noisy = run(.1), noisier = run(.3);
+    CHECK(clean.first > 80);
+    CHECK(noisy.first < clean.first);
+    // No edge but the start of second's, until noise makes rivals
+    CHECK(clean.second == 100);
+    CHECK(noisy.second < clean.second);
+    CHECK(noisier.second < noisy.second);
+}
+
+TEST_CASE("test lock telemetry") {
+    wwvb_signal_config config;
+    config.start = 1636200030;
+    wwvb_signal_generator gen(config);
+    wwvb_rng noise(7);
+    WWVBDecoder<> dec;
+    auto run = [&](int seconds, bool faded) {
+        for (int i = 0; i < seconds * 50; i++) {
+            bool b = gen.next();
+            if (faded)
+                b = noise.next() & 1;
+            wwvb_time m;
+            if (dec.update(b) && dec.symbols.at(dec.SYMBOLS - 1) == 2)
+                dec.decode_minute(m);
+        }
+    };
+    const auto &l = dec.lock;
+
+    run(200, false);
+    CHECK(l.locked());
+    CHECK(l.first_stable_sos > 0);
+    CHECK(l.first_stable_sos <= l.first_valid_minute);
+    CHECK(l.first_valid_symbols <= l.first_valid_minute);
+    CHECK(l.first_lock == l.first_valid_minute);
+    CHECK(l.acquisition.count == 1);
+
+    run(20, true);
+    CHECK(!l.locked());
+    CHECK(l.holdover.count == 1);
+
+    run(200, false);
+    CHECK(l.locked());
+    CHECK(l.acquisition.count == 2);
+    CHECK(l.first_lock < l.locked_since);
+}
+
+TEST_CASE("test compact decoder") {
+    typedef WWVBDecoder<50, 60, 40, true> compact;
+    static_assert(sizeof(compact) < sizeof(WWVBDecoder<>) / 2,
+                  "compact decoder is not compact");
+    static_assert(sizeof(compact::counts[0]) == 1, "");
+    static_assert(alignof(WWVBDecoder<>) == 64, "");
+
+    wwvb_signal_config config;
+    config.start = 1636200030;
+    config.flip_probability = .05;
+    wwvb_signal_generator gen(config);
+    WWVBDecoder<> full;
+    compact small;
+    // The old field order decodes the same too
+    WWVBDecoder<50, 60, 40, false, false, false, false> legacy;
+    int minutes = 0;
+    for (int i = 0; i < 10 * 60 * 50; i++) {
+        bool b = gen.next();
+        bool second = full.update(b);
+        REQUIRE(second == small.update(b));
+        REQUIRE(second == legacy.update(b));
+        REQUIRE(full.sos == small.sos);
+        REQUIRE(full.health == small.health);
+        REQUIRE(full.health == legacy.health);
+        wwvb_time m1, m2;
+        if (second && full.symbols.at(59) == 2 && full.decode_minute(m1)) {
+            REQUIRE(small.decode_minute(m2));
+            CHECK(m1 == m2);
+            minutes++;
+        }
+    }
+    CHECK(minutes > 5);
+}
+
+TEST_CASE("test bitsliced decoder") {
+    // Each lane has its own start time, noise and fades
+    std::vector<std::unique_ptr<wwvb_signal_generator>> gens;
+    for (int j = 0; j < 64; j++) {
+        wwvb_signal_config config;
+        config.start = 1636200000 + j * 7;
+        config.flip_probability = j % 5 * .03;
+        config.fades_per_hour = j % 3 * 20;
+        config.seed = j + 1;
+        gens.emplace_back(new wwvb_signal_generator(config));
+    }
+    std::vector<WWVBDecoder<>> scalar(64);
+    std::unique_ptr<BitslicedWWVBDecoder<>> sliced(new BitslicedWWVBDecoder<>);
+
+    int minutes = 0;
+    for (int i = 0; i < 4 * 60 * 50; i++) {
+        uint64_t w = 0;
+        for (int j = 0; j < 64; j++)
+            w |= uint64_t(gens[j]->next()) << j;
+        uint64_t seconds = sliced->update(w);
+        for (int j = 0; j < 64; j++) {
+            auto &dec = scalar[j];
+            bool second = dec.update(w >> j & 1);
+            REQUIRE(second == bool(seconds >> j & 1));
+            REQUIRE(dec.sos == sliced->sos(j));
+            if (!second)
+                continue;
+            REQUIRE(dec.health == sliced->health(j));
+            REQUIRE(dec.symbols.at(59) == sliced->symbol(j, 59));
+            wwvb_time m1, m2;
+            bool ok = dec.decode_minute(m1);
+            REQUIRE(ok == sliced->decode_minute(j, m2));
+            if (ok) {
+                CHECK(m1 == m2);
+                minutes++;
+            }
+        }
+    }
+    CHECK(minutes > 64);
+}
+
+TEST_CASE("test multichannel decoder") {
+    constexpr int N = 32;
+    std::vector<std::unique_ptr<wwvb_signal_generator>> gens;
+    for (int j = 0; j < N; j++) {
+        wwvb_signal_config config;
+        config.start = 1636200000 + j * 11;
+        config.flip_probability = j % 4 * .04;
+        config.fades_per_hour = j % 3 * 20;
+        config.seed = j + 100;
+        gens.emplace_back(new wwvb_signal_generator(config));
+    }
+    std::vector<WWVBDecoder<>> scalar(N);
+    std::unique_ptr<MultichannelWWVBDecoder<N>> multi(
+        new MultichannelWWVBDecoder<N>);
+
+    int minutes = 0;
+    for (int i = 0; i < 3 * 60 * 50; i++) {
+        uint64_t w = 0;
+        for (int j = 0; j < N; j++)
+            w |= uint64_t(gens[j]->next()) << j;
+        bool any = multi->update(&w);
+        bool any_scalar = false;
+        for (int j = 0; j < N; j++) {
+            auto &dec = scalar[j];
+            bool second = dec.update(w >> j & 1);
+            any_scalar |= second;
+            REQUIRE(second == multi->at_second(j));
+            REQUIRE(dec.sos == multi->sos[j]);
+            if (!second)
+                continue;
+            REQUIRE(dec.health == multi->health(j));
+            REQUIRE(dec.symbols.at(59) == multi->symbol(j, 59));
+            wwvb_time m1, m2;
+            bool ok = dec.decode_minute(m1);
+            REQUIRE(ok == multi->decode_minute(j, m2));
+            if (ok) {
+                CHECK(m1 == m2);
+                minutes++;
+            }
+        }
+        REQUIRE(any == any_scalar);
+    }
+    CHECK(minutes > N);
+}
+
+TEST_CASE("test diversity combining") {
+    // Over a few pairs of receivers of the same signal, with different delays
+    // and their own noise and fades, the combined stream must beat picking
+    // the better of two independent decodes: any minute either receiver
+    // decoded on its own counts for that
+    int best_of_two = 0, combined = 0;
+    for (int seed = 1; seed <= 4; seed++) {
+        wwvb_signal_config c0, c1;
+        c0.start = c1.start = 1636200007;
+        c0.seed = seed;
+        c1.seed = 100 + seed;
+        c1.delay_min_ms = 200;
+        c1.delay_max_ms = 260;
+        c0.fades_per_hour = c1.fades_per_hour = 60;
+        c0.fade_seconds = c1.fade_seconds = 10;
+        c0.flip_probability = c1.flip_probability = .05;
+        wwvb_signal_generator g0(c0), g1(c1);
+
+        std::unique_ptr<wwvb_diversity_combiner<>> comb(
+            new wwvb_diversity_combiner<>);
+        // The correct minutes, and the sample that completed the first; the
+        // combined stream follows the later receiver
+        wwvb_signal_generator *gens[] = {&g0, &g1, &g1};
+        std::set<time_t> minutes[3];
+        uint64_t first[3] = {UINT64_MAX, UINT64_MAX, UINT64_MAX};
+        for (uint64_t i = 0; i < 90 * 60 * 50; i++) {
+            comb->update(g0.next(), g1.next());
+            const WWVBDecoder<> *decs[] = {
+                &comb->trackers[0], &comb->trackers[1], &comb->dec};
+            for (int k = 0; k < 3; k++) {
+                wwvb_time m;
+                if (decs[k]->tss || decs[k]->symbols.at(59) != 2 ||
+                    !decs[k]->decode_minute(m))
+                    continue;
+                double lag = gens[k]->utc_of_sample(i) - (m.to_utc() + 60);
+                if (lag >= -.5 && lag <= 1) {
+                    minutes[k].insert(m.to_utc());
+                    first[k] = std::min(first[k], i);
+                }
+            }
+        }
+        // The receivers' delays differ by 120 to 220ms
+        CHECK(comb->offset >= 6);
+        CHECK(comb->offset <= 11);
+        // Within the offset, no later than the faster receiver
+        CHECK(first[2] < std::min(first[0], first[1]) + 50);
+        minutes[0].insert(minutes[1].begin(), minutes[1].end());
+        best_of_two += minutes[0].size();
+        combined += minutes[2].size();
+    }
+    CHECK(combined > best_of_two + 10);
+}
+
+TEST_CASE("test adaptive history") {
+    // After a step in the receiver's delay, the adaptive window follows the
+    // new start of second sooner
+    auto seconds_to_follow = [](auto &dec) {
+        wwvb_signal_config config;
+        config.start = 1636200007;
+        config.flip_probability = .02;
+        wwvb_signal_generator gen(config);
+        for (int i = 0; i < 3 * 60 * 50; i++)
+            dec.update(gen.next());
+        int before = dec.sos;
+        for (int i = 0; i < 20; i++)
+            gen.next();
+        int after = (before + 50 - 20) % 50;
+        for (int i = 0; i < 60 * 50; i++) {
+            dec.update(gen.next());
+            if (std::abs(dec.sos - after) <= 1)
+                return i / 50;
+        }
+        return 60;
+    };
+    std::unique_ptr<WWVBDecoder<>> fixed(new WWVBDecoder<>);
+    std::unique_ptr<WWVBDecoder<50, 60, 40, false, true>> adaptive(
+        new WWVBDecoder<50, 60, 40, false, true>);
+    CHECK(adaptive->window == 10);
+    int f = seconds_to_follow(*fixed), a = seconds_to_follow(*adaptive);
+    CHECK(f >= 15);
+    CHECK(a + 3 <= f);
+}
+
+TEST_CASE("test sub-bucket start of second") {
+    // Seconds whose reduced carrier begins at x0 buckets, give or take a
+    // bucket
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> jitter(-1, 1);
+    double error = 0, bucket_error = 0;
+    int n = 0;
+    for (double x0 = 0.25; x0 < 49.5; x0 += 2.13, n++) {
+        std::unique_ptr<WWVBDecoder<>> dec(new WWVBDecoder<>);
+        for (int s = 0; s < 61; s++) {
+            double x = x0 + jitter(rng);
+            for (int k = 0; k < 50; k++) {
+                double d = k - x;
+                d = d < -25 ? d + 50 : d >= 25 ? d - 50 : d;
+                dec->update(d >= 0 && d < 10);
+            }
+        }
+        auto wrapped = [](double d) {
+            d = std::abs(d);
+            return d > 25 ? 50 - d : d;
+        };
+        double e = wrapped(dec->sos_q8() / 256. - x0);
+        CHECK(e < .5);
+        error += e;
+        bucket_error += wrapped(dec->sos - .5 - x0);
+    }
+    CHECK(error / n < .1);
+    CHECK(error * 2 < bucket_error);
+}
+
+TEST_CASE("test phase-locked seconds") {
+    // Seconds give or take a bucket, from a clock running 0.1% fast, with a
+    // 20 bucket step in the receiver's delay halfway through
+    typedef WWVBDecoder<50, 60, 40, false, false, true> pll_decoder;
+    std::unique_ptr<pll_decoder> dec(new pll_decoder);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> jitter(-1, 1);
+    int ticks = 0, last = -1, short_gaps = 0;
+    int min_gap = 1000, max_gap = 0, max_error = 0;
+    double x0 = 7.25;
+    for (int s = 0; s < 400; s++) {
+        x0 += .05;
+        if (s == 200)
+            x0 += 20;
+        double x = x0 + jitter(rng);
+        for (int k = 0; k < 50; k++) {
+            int n = s * 50 + k;
+            double d = k - x;
+            d = d - 50 * std::floor((d + 25) / 50);
+            bool b = d >= 0 && d < 10;
+            if (!dec->update(b))
+                continue;
+            ticks++;
+            if (last >= 0 && n - last < 25)
+                short_gaps++;
+            // Once locked, and away from the step
+            if (s > 60 && (s < 200 || s > 270)) {
+                min_gap = std::min(min_gap, n - last);
+                max_gap = std::max(max_gap, n - last);
+                int e = std::abs(int(dec->subsec) -
+                                 int(std::ceil(std::fmod(x0, 50))) % 50);
+                max_error = std::max(max_error, std::min(e, 50 - e));
+            }
+            last = n;
+        }
+    }
+    CHECK(dec->pll.locked);
+    CHECK(short_gaps == 0);
+    CHECK(min_gap >= 49);
+    CHECK(max_gap <= 51);
+    CHECK(max_error <= 1);
+    CHECK(std::abs(ticks - 400) <= 1);
+}
+
+TEST_CASE("test start of second hypotheses") {
+    // After a 20 bucket step in the receiver's delay, the marks are read
+    // right again sooner with hypotheses than with the sharpest edge alone
+    auto seconds_to_recover = [](auto &dec) {
+        int last_bad = 0;
+        for (int s = 0; s < 200; s++) {
+            int x = s < 100 ? 7 : 27;
+            for (int k = 0; k < 50; k++) {
+                int d = (k - x + 50) % 50;
+                if (dec.update(d < 40) && s > 100 &&
+                    dec.symbols.at(dec.SYMBOLS - 1) != 2)
+                    last_bad = s;
+            }
+        }
+        return last_bad - 100;
+    };
+    std::unique_ptr<WWVBDecoder<>> plain(new WWVBDecoder<>);
+    std::unique_ptr<wwvb_hypothesis_decoder<>> dec(
+        new wwvb_hypothesis_decoder<>);
+    int p = seconds_to_recover(*plain), h = seconds_to_recover(*dec);
+    CHECK(dec->promotions == 1);
+    CHECK(h + 10 <= p);
+    CHECK(dec->sos == 27);
+    CHECK(dec->health > int(dec->MAX_HEALTH) * 9 / 10);
+}
+
+TEST_CASE("test decoder snapshot") {
+    wwvb_signal_config config;
+    config.start = 1618315200;
+    wwvb_signal_generator gen(config);
+    std::unique_ptr<WWVBDecoder<>> dec(new WWVBDecoder<>);
+    wwvb_seqlock<wwvb_decoder_snapshot<WWVBDecoder<>>> published;
+    wwvb_decoder_snapshot<WWVBDecoder<>> snapshot;
+    int minutes = 0;
+    for (int i = 0; i < 50 * 150; i++) {
+        if (!dec->update(gen.next()))
+            continue;
+        published.next().capture(*dec);
+        published.commit();
+        CHECK(published.try_read(snapshot));
+        CHECK(snapshot.sos == dec->sos);
+        CHECK(snapshot.sos_q8() == dec->sos_q8());
+        CHECK(snapshot.health == dec->health);
+        CHECK(snapshot.sharpness_pct() == dec->sharpness_pct());
+        CHECK(snapshot.symbols.at(59) == dec->symbols.at(59));
+        wwvb_time a, b;
+        wwvb_decode_stats stats;
+        bool ok = dec->decode_minute(a);
+        CHECK(snapshot.decode_minute(b, stats) == ok);
+        if (ok) {
+            CHECK(a == b);
+            minutes++;
+        }
+    }
+    CHECK(minutes >= 1);
+}
+
+TEST_CASE("test seqlock") {
+    // A writer on another thread publishes as fast as it can; every copy
+    // the reader accepts must be whole
+    struct item {
+        std::array<uint32_t, 64> v;
+    };
+    std::unique_ptr<wwvb_seqlock<item>> lock(new wwvb_seqlock<item>);
+    std::atomic<bool> done{};
+    std::thread writer([&] {
+        for (uint32_t n = 1; n <= 200000; n++) {
+            lock->next().v.fill(n);
+            lock->commit();
+        }
+        done = true;
+    });
+    item it;
+    uint32_t last = 0;
+    bool whole = true, ordered = true;
+    while (!done) {
+        lock->read(it);
+        for (auto x : it.v)
+            whole &= x == it.v[0];
+        ordered &= it.v[0] >= last;
+        last = it.v[0];
+    }
+    writer.join();
+    lock->read(it);
+    CHECK(whole);
+    CHECK(ordered);
+    CHECK(it.v[0] == 200000);
+}
+
+TEST_CASE("test minute record") {
+    struct wwvb_time ww = {
+        .yday = 73,
+        .year = 21,
+        .hour = 7,
+        .minute = 30,
+        .second = 0,
+        .ls = 0,
+        .ly = 0,
+        .dst = 2,
+        .dut1 = -3,
+    };
+    WWVBDecoder<> dec;
+    auto r = minute_record::make(dec, ww, 12345);
+    CHECK(r.sample == 12345);
+    CHECK(r.subsec == 50);
+    CHECK(r.max_health() == (int)dec.MAX_HEALTH);
+    CHECK(r.time() == ww);
+
+    output_format fmt;
+    CHECK(parse_output_format("jsonl", fmt));
+    CHECK(fmt == output_format::jsonl);
+    CHECK(!parse_output_format("xml", fmt));
+
+    // The maximum health follows the decoder's SYMBOLS
+    WWVBDecoder<50, 120> dec120;
+    CHECK(minute_record::make(dec120, ww, 0).max_health() ==
+          (int)dec120.MAX_HEALTH);
+}
+
+TEST_CASE("test output formats") {
+    struct wwvb_time ww = {
+        .yday = 73,
+        .year = 21,
+        .hour = 7,
+        .minute = 30,
+        .second = 0,
+        .ls = 0,
+        .ly = 0,
+        .dst = 2,
+        .dut1 = -3,
+    };
+    WWVBDecoder<> dec;
+    dec.health = 2950;
+    dec.sos = 17;
+    auto r = minute_record::make(dec, ww, 12345);
+
+    auto render = [&](output_format fmt) {
+        FILE *f = tmpfile();
+        REQUIRE(f);
+        {
+            buffered_writer out(fileno(f));
+            output_sink sink(out, fmt);
+            sink.begin();
+            sink.minute(r);
+        }
+        rewind(f);
+        std::string result;
+        for (int c; (c = fgetc(f)) != EOF;)
+            result += c;
+        fclose(f);
+        return result;
+    };
+
+    CHECK(render(output_format::text) == "[ 246.90] 2021-03-14  7:30 0 2\n"
+                                         "          2021-03-14  1:30\n"
+                                         "          2021-073    7:30\n"
+                                         "Health 2950 / 3000 (98.33%)\n");
+    CHECK(render(output_format::csv) ==
+          "sample,seconds,utc,time,year,yday,hour,minute,ls,ly,dst,dut1,"
+          "health,max_health,sos\n"
+          "12345,246.90,1615707000,2021-03-14T07:30:00Z,2021,73,7,30,0,0,2,-3,"
+          "2950,3000,17\n");
+    CHECK(render(output_format::jsonl) ==
+          "{\"sample\":12345,\"seconds\":246.90,\"utc\":1615707000,"
+          "\"time\":\"2021-03-14T07:30:00Z\",\"year\":2021,\"yday\":73,"
+          "\"hour\":7,\"minute\":30,\"ls\":0,\"ly\":0,\"dst\":2,"
+          "\"dut1\":-3,\"health\":2950,\"max_health\":3000,\"sos\":17}\n");
+    auto binary = render(output_format::binary);
+    REQUIRE(binary.size() == sizeof(r));
+    CHECK(!memcmp(binary.data(), &r, sizeof(r)));
+}
+
+TEST_CASE("test spsc ring") {
+    auto ring = make_ring<int, 4>();
+    int v;
+    CHECK(!ring->try_pop(v));
+    for (int i = 0; i < 4; i++)
+        CHECK(ring->try_push(i));
+    CHECK(!ring->try_push(4));
+    for (int i = 0; i < 3; i++) {
+        CHECK(ring->try_pop(v));
+        CHECK(v == i);
+    }
+    CHECK(ring->try_push(4));
+    ring->close();
+    CHECK(ring->pop(v));
+    CHECK(v == 3);
+    CHECK(ring->pop(v));
+    CHECK(v == 4);
+    CHECK(!ring->pop(v));
+
+    // Each side sleeps until the other wakes it
+    auto ring2 = make_ring<int, 4>();
+    std::thread consumer([&] {
+        int sum = 0;
+        for (int x; ring2->pop(x);)
+            sum += x;
+        CHECK(sum == 45);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (int i = 0; i < 10; i++)
+        ring2->push(i);
+    ring2->close();
+    consumer.join();
+}
+
+TEST_CASE("test decoder pool") {
+    // Each receiver's stream, cut into blocks of varying length
+    constexpr int RECEIVERS = 12;
+    std::vector<std::vector<sample_block>> streams(RECEIVERS);
+    for (int k = 0; k < RECEIVERS; k++) {
+        wwvb_signal_config config;
+        config.start = 1636200000 + k * 17;
+        config.flip_probability = k % 3 * .02;
+        config.seed = k + 1;
+        wwvb_signal_generator gen(config);
+        for (int n = 0; n < 3 * 60 * 50;) {
+            sample_block b{};
+            b.len = 1000 + k * 100;
+            for (size_t j = 0; j < b.len; j++, n++)
+                b.bits[j / 64] |= uint64_t(gen.next()) << (j % 64);
+            streams[k].push_back(b);
+        }
+    }
+
+    // Receiver 0 is removed partway, and receiver RECEIVERS-1 is added late
+    std::vector<size_t> first(RECEIVERS), last(RECEIVERS);
+    for (int k = 0; k < RECEIVERS; k++)
+        last[k] = streams[k].size();
+    last[0] = 4;
+    first[RECEIVERS - 1] = 3;
+
+    // What one decoder per receiver finds, in order
+    std::vector<std::vector<minute_record>> expected(RECEIVERS);
+    for (int k = 0; k < RECEIVERS; k++) {
+        WWVBDecoder<> dec;
+        uint64_t i = 0;
+        for (size_t n = first[k]; n < last[k]; n++) {
+            const auto &b = streams[k][n];
+            for (size_t j = 0; j < b.len; j++, i++) {
+                wwvb_time m;
+                if (dec.update(b.at(j)) && dec.symbols.at(59) == 2 &&
+                    dec.decode_minute(m))
+                    expected[k].push_back(minute_record::make(dec, m, i));
+            }
+        }
+    }
+
+    std::unique_ptr<wwvb_decoder_pool<>> pool(new wwvb_decoder_pool<>(3));
+    std::vector<std::vector<minute_record>> actual(RECEIVERS);
+    std::thread consumer([&] {
+        wwvb_pool_record r;
+        while (pool->pop(r))
+            actual.at(r.receiver).push_back(r.minute);
+    });
+    for (int k = 0; k < RECEIVERS - 1; k++)
+        pool->add(k);
+    for (size_t n = 0;; n++) {
+        bool any = false;
+        if (n == first[RECEIVERS - 1])
+            pool->add(RECEIVERS - 1);
+        if (n == last[0])
+            pool->remove(0);
+        for (int k = 0; k < RECEIVERS; k++) {
+            if (n >= first[k] && n < last[k]) {
+                pool->submit(k, streams[k][n]);
+                any = true;
+            }
+        }
+        if (!any)
+            break;
+    }
+    pool->submit(RECEIVERS + 5, streams[1][0]); // unknown: dropped
+    pool->close();
+    consumer.join();
+
+    int minutes = 0;
+    for (int k = 0; k < RECEIVERS; k++) {
+        REQUIRE(actual[k].size() == expected[k].size());
+        for (size_t i = 0; i < actual[k].size(); i++) {
+            CHECK(actual[k][i].sample == expected[k][i].sample);
+            CHECK(actual[k][i].utc == expected[k][i].utc);
+            minutes++;
+        }
+    }
+    CHECK(minutes > RECEIVERS);
+}
+
+TEST_CASE("test idle decoder pool") {
+    // Neither the shards nor a thread waiting in pop() keep a core busy
+    std::unique_ptr<wwvb_decoder_pool<>> pool(new wwvb_decoder_pool<>(2));
+    std::thread consumer([&] {
+        wwvb_pool_record r;
+        while (pool->pop(r)) {
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto start = std::clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    double cpu = double(std::clock() - start) / CLOCKS_PER_SEC;
+    pool->close();
+    consumer.join();
+    CHECK(cpu < 0.1);
+}
+
+TEST_CASE("test any decoder") {
+    CHECK(!make_any_decoder(60));
+    auto any = make_any_decoder(100);
+    REQUIRE(any);
+    CHECK(any->subsec() == 100);
+
+    wwvb_signal_config config;
+    config.start = 1636236007;
+    config.rate = 100;
+    config.flip_probability = .01;
+    wwvb_signal_generator gen(config);
+    WWVBDecoder<100> dec;
+    std::vector<minute_record> expected, actual;
+    wwvb_any_decoder::emit_type emit = [&](const minute_record &r) {
+        actual.push_back(r);
+    };
+    for (int n = 0; n < 4 * 60 * 100;) {
+        sample_block b{};
+        for (; b.len < 3000; b.len++, n++) {
+            bool s = gen.next();
+            b.bits[b.len / 64] |= uint64_t(s) << (b.len % 64);
+            wwvb_time m;
+            if (dec.update(s) && dec.symbols.at(59) == 2 &&
+                dec.decode_minute(m))
+                expected.push_back(
+                    minute_record::make(dec, m, dec.sample_count - 1));
+        }
+        any->decode(b, emit);
+    }
+    REQUIRE(expected.size() >= 3);
+    REQUIRE(actual.size() == expected.size());
+    for (size_t i = 0; i < actual.size(); i++) {
+        CHECK(actual[i].sample == expected[i].sample);
+        CHECK(actual[i].utc == expected[i].utc);
+    }
+    CHECK(any->minute_count() == expected.size());
+    CHECK(any->health() == dec.health);
+}
+
+TEST_CASE("test decimator") {
+    // Against a sample-at-a-time version, with blocks of awkward lengths
+    uint64_t x = 88172645463325252ull;
+    auto rand = [&] {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    };
+    for (int factor : {1, 3, 20, 64}) {
+        std::vector<bool> in;
+        for (int i = 0; i < 5000; i++)
+            in.push_back(rand() % 4 == 0);
+
+        std::vector<bool> expected;
+        bool last = false;
+        for (size_t g = 0; g + factor <= in.size(); g += factor) {
+            int count = 0;
+            for (size_t i = g; i < g + factor; i++) {
+                bool l = i ? in[i - 1] : false, m = in[i];
+                bool r = i + 1 < in.size() ? in[i + 1] : in[i];
+                count += (l + m + r) >= 2;
+            }
+            if (count * 2 != factor)
+                last = count * 2 > factor;
+            expected.push_back(last);
+        }
+
+        wwvb_decimator dec(factor);
+        std::vector<bool> actual;
+        auto emit = [&](const sample_block &b) {
+            for (size_t i = 0; i < b.len; i++)
+                actual.push_back(b.at(i));
+        };
+        for (size_t i = 0; i < in.size();) {
+            sample_block b{};
+            size_t len = std::min<size_t>(rand() % 300 + 1, in.size() - i);
+            for (; b.len < len; b.len++, i++)
+                b.bits[b.len / 64] |= uint64_t(in[i]) << (b.len % 64);
+            dec.feed(b, emit);
+        }
+        dec.finish(emit);
+        CHECK(actual == expected);
+    }
+
+    // Decoding 1kHz samples with short glitches at 50Hz
+    wwvb_signal_config config;
+    config.start = 1636200007;
+    config.rate = 1000;
+    config.flip_probability = .1;
+    wwvb_signal_generator gen(config);
+    WWVBDecoder<> picked, filtered;
+    wwvb_decimator decimator(20);
+    auto emit = [&](const sample_block &b) {
+        for (size_t i = 0; i < b.len; i++)
+            filtered.update(b.at(i));
+    };
+    for (int n = 0; n < 3 * 60 * 1000;) {
+        sample_block b{};
+        for (; b.len < b.SIZE; b.len++, n++) {
+            bool s = gen.next();
+            if (n % 20 == 10)
+                picked.update(s);
+            b.bits[b.len / 64] |= uint64_t(s) << (b.len % 64);
+        }
+        decimator.feed(b, emit);
+    }
+    CHECK(filtered.health > picked.health);
+    CHECK(filtered.health * 100 > int(filtered.MAX_HEALTH) * 98);
+}
+
+TEST_CASE("test sample unpacker") {
+    raw_block raw;
+    const char text[] = "_#\n__x#";
+    raw.len = sizeof(text) - 1;
+    memcpy(raw.data, text, raw.len);
+
+    sample_unpacker ascii(input_format::ascii);
+    std::vector<sample_block> blocks;
+    auto emit = [&](const sample_block &b) { blocks.push_back(b); };
+    ascii.feed(raw, emit);
+    CHECK(blocks.empty());
+    ascii.finish(emit);
+    REQUIRE(blocks.size() == 1);
+    CHECK(blocks[0].len == 5);
+    CHECK(blocks[0].bits[0] == 0b01101);
+
+    blocks.clear();
+    sample_unpacker packed(input_format::packed);
+    raw.len = 2;
+    raw.data[0] = 0x81;
+    raw.data[1] = 0x02;
+    packed.feed(raw, emit);
+    packed.finish(emit);
+    REQUIRE(blocks.size() == 1);
+    CHECK(blocks[0].len == 16);
+    CHECK(blocks[0].at(0));
+    CHECK(!blocks[0].at(1));
+    CHECK(blocks[0].at(7));
+    CHECK(blocks[0].at(9));
+}
+
+TEST_CASE("test gzip decompression") {
+    static const char text[] = "__________#########################";
+    raw_block raw;
+    z_stream zs{};
+    REQUIRE(deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK);
+    zs.next_in = (unsigned char *)text;
+    zs.avail_in = sizeof(text) - 1;
+    zs.next_out = raw.data;
+    zs.avail_out = raw_block::SIZE;
+    REQUIRE(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    raw.len = raw_block::SIZE - zs.avail_out;
+    deflateEnd(&zs);
+
+    CHECK(detect_compression(raw.data, raw.len) == compression::gzip);
+    CHECK(detect_compression((const unsigned char *)text, 4) ==
+          compression::none);
+
+    std::string result;
+    auto emit = [&](const raw_block &b) {
+        result.append((const char *)b.data, b.len);
+    };
+    {
+        stream_decompressor d(compression::gzip);
+        CHECK(d.feed(raw, emit));
+        CHECK(d.finish(emit));
+        CHECK(result == text);
+    }
+
+    // Losing the trailer is reported
+    result.clear();
+    raw.len -= 4;
+    stream_decompressor d(compression::gzip);
+    CHECK(d.feed(raw, emit));
+    CHECK(!d.finish(emit));
+}
+
+TEST_CASE("test xz decompression") {
+    static const char text[] = "__________#########################";
+    raw_block raw;
+    raw.len = 0;
+    REQUIRE(lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr,
+                                    (const uint8_t *)text, sizeof(text) - 1,
+                                    raw.data, &raw.len,
+                                    raw_block::SIZE) == LZMA_OK);
+
+    CHECK(detect_compression(raw.data, raw.len) == compression::xz);
+
+    std::string result;
+    auto emit = [&](const raw_block &b) {
+        result.append((const char *)b.data, b.len);
+    };
+    {
+        stream_decompressor d(compression::xz);
+        CHECK(d.feed(raw, emit));
+        CHECK(d.finish(emit));
+        CHECK(result == text);
+    }
+
+    // Losing the end of the stream is reported
+    result.clear();
+    raw.len -= 4;
+    stream_decompressor d(compression::xz);
+    CHECK(d.feed(raw, emit));
+    CHECK(!d.finish(emit));
+    CHECK(d.error());
+}
 #endif
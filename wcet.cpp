@@ -0,0 +1,295 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Worst-case execution time of WWVBDecoder::update, which the firmware calls
+// from its sampling interrupt.  Calls are split into ordinary samples and
+// those that conclude a second (and so also run decode_symbol), and the
+// distribution of each is reported.
+//
+// A host is not an interrupt handler: the process can be preempted or take
+// a cache miss at any moment.  So each stream is decoded several times and
+// each call keeps its fastest time; an outlier that persists in every
+// repetition is a property of the code path, not of the host.  The
+// distribution is of those best-of-N times, and the slowest of all the
+// calls in every repetition is reported beside it, as an upper bound.
+//
+// The stream is decoded a chunk at a time: each repetition of a chunk
+// starts from a copy of the decoder as it was at the start of the chunk, so
+// only a chunk's timings are kept, and the distribution is counted as it
+// goes.
+
+#ifndef ARDUINO
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include "decoder.h"
+#include "decompress.h"
+#include "generator.h"
+#include "instrument.h"
+#include "pipeline.h"
+
+struct options {
+    int rate = 50;
+    double hours = 24;
+    unsigned repeats = 5;
+    wwvb_signal_config config;
+    input_format fmt = input_format::ascii;
+};
+
+static bool load(const char *path, input_format fmt,
+                 std::vector<uint8_t> &samples) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    sample_unpacker unpack(fmt);
+    auto emit = [&](const sample_block &b) {
+        for (size_t i = 0; i < b.len; i++)
+            samples.push_back(b.at(i));
+    };
+    auto feed = [&](const raw_block &b) { unpack.feed(b, emit); };
+    std::unique_ptr<raw_block> raw(new raw_block);
+    std::unique_ptr<stream_decompressor> inflater;
+    bool first = true, ok = true;
+    for (ssize_t n; ok && (n = read(fd, raw->data, raw_block::SIZE)) > 0;) {
+        raw->len = n;
+        if (first) {
+            auto kind = detect_compression(raw->data, raw->len);
+            if (kind != compression::none)
+                inflater.reset(new stream_decompressor(kind));
+            first = false;
+        }
+        ok = inflater ? inflater->feed(*raw, feed) : (feed(*raw), true);
+    }
+    close(fd);
+    if (inflater && ok)
+        ok = inflater->finish(feed);
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", path, inflater->error());
+        return false;
+    }
+    unpack.finish(emit);
+    return true;
+}
+
+// Estimate the rate of WWVB_CYCLES, for reporting in microseconds
+static double cycles_per_us() {
+    auto t0 = std::chrono::steady_clock::now();
+    auto c0 = WWVB_CYCLES();
+    while (std::chrono::steady_clock::now() - t0 <
+           std::chrono::milliseconds(50))
+        ;
+    auto c1 = WWVB_CYCLES();
+    auto us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - t0)
+                  .count();
+    return (c1 - c0) / us;
+}
+
+// Exact counts of each cost up to LIMIT cycles, for percentiles without
+// keeping every timing
+struct cost_histogram {
+    static constexpr uint32_t LIMIT = 1 << 16;
+    std::vector<uint64_t> counts = std::vector<uint64_t>(LIMIT + 1);
+    uint64_t total{};
+
+    void record(uint32_t c) {
+        counts[std::min(c, LIMIT)]++;
+        total++;
+    }
+
+    // The cost of the call at fraction p of the way through the calls in
+    // order; LIMIT if it is at least that
+    uint32_t percentile(double p) const {
+        uint64_t rank = std::min<uint64_t>(total - 1, p * total), seen = 0;
+        for (uint32_t c = 0; c < LIMIT; c++) {
+            seen += counts[c];
+            if (seen > rank)
+                return c;
+        }
+        return LIMIT;
+    }
+};
+
+struct kind_report {
+    const char *name;
+    // Each call's fastest time
+    wwvb_stage_stats stats;
+    cost_histogram costs;
+    size_t worst_sample;
+    // Every time of every call
+    uint32_t slowest;
+    size_t slowest_sample;
+
+    void record_best(uint32_t d, size_t sample) {
+        if (d > stats.max || !stats.count)
+            worst_sample = sample;
+        stats.record(d);
+        costs.record(d);
+    }
+};
+
+static void print_report(const kind_report &k, unsigned repeats,
+                         double cpu) {
+    if (!k.stats.count)
+        return;
+    printf("%-8s %10lu calls, best of %u:  min %6lu  mean %6lu  p99 %6lu  "
+           "p99.99 %6lu  max %7lu cycles (%.2f us, sample %zu)\n",
+           k.name, (unsigned long)k.stats.count, repeats,
+           (unsigned long)k.stats.min, (unsigned long)k.stats.mean(),
+           (unsigned long)k.costs.percentile(.99),
+           (unsigned long)k.costs.percentile(.9999),
+           (unsigned long)k.stats.max, k.stats.max / cpu, k.worst_sample);
+    printf("%-8s slowest of all %u runs: %7lu cycles (%.2f us, sample %zu)\n",
+           "", repeats, (unsigned long)k.slowest, k.slowest / cpu,
+           k.slowest_sample);
+    for (int b = 0; b < k.stats.BUCKETS; b++) {
+        if (k.stats.histogram[b])
+            printf("    < %-10lu %10lu\n", 1ul << b,
+                   (unsigned long)k.stats.histogram[b]);
+    }
+}
+
+// fill(out, n) supplies the next n of the count samples
+template <class Decoder, class F>
+static void measure(const char *name, size_t count, F &&fill,
+                    unsigned repeats, double cpu) {
+    constexpr size_t CHUNK = 1 << 16;
+    std::vector<uint8_t> samples(CHUNK);
+    std::vector<uint32_t> best(CHUNK);
+    std::vector<bool> second(CHUNK);
+    std::unique_ptr<Decoder> start(new Decoder), dec(new Decoder);
+    kind_report kinds[2] = {{"sample"}, {"second"}};
+
+    for (size_t base = 0; base < count; base += CHUNK) {
+        size_t n = std::min(CHUNK, count - base);
+        fill(samples.data(), n);
+        std::fill(best.begin(), best.end(), UINT32_MAX);
+        for (unsigned r = 0; r < repeats; r++) {
+            *dec = *start;
+            for (size_t i = 0; i < n; i++) {
+                auto t0 = WWVB_CYCLES();
+                bool s = dec->update(samples[i]);
+                auto d = uint32_t(WWVB_CYCLES() - t0);
+                best[i] = std::min(best[i], d);
+                second[i] = s;
+                auto &k = kinds[s];
+                if (d > k.slowest) {
+                    k.slowest = d;
+                    k.slowest_sample = base + i;
+                }
+            }
+        }
+        *start = *dec;
+        for (size_t i = 0; i < n; i++)
+            kinds[second[i]].record_best(best[i], base + i);
+    }
+
+    printf("%s: %zu samples at %d Hz, %u runs\n", name, count,
+           (int)Decoder::SUBSEC, repeats);
+    for (int k = 0; k < 2; k++)
+        print_report(kinds[k], repeats, cpu);
+    auto worst = std::max(kinds[0].stats.max, kinds[1].stats.max);
+    auto slowest = std::max(kinds[0].slowest, kinds[1].slowest);
+    printf("worst case %.2f us best of %u, %.2f us slowest, against the "
+           "%.0f us sample period (%.4f%%, %.4f%%)\n\n",
+           worst / cpu, repeats, slowest / cpu, 1e6 / Decoder::SUBSEC,
+           worst / cpu * Decoder::SUBSEC / 1e4,
+           slowest / cpu * Decoder::SUBSEC / 1e4);
+}
+
+template <class Decoder> static int run(const options &o, char **files) {
+    double cpu = cycles_per_us();
+    if (!*files) {
+        wwvb_signal_config config = o.config;
+        config.rate = Decoder::SUBSEC;
+        wwvb_signal_generator gen(config);
+        auto fill = [&](uint8_t *out, size_t n) {
+            for (size_t i = 0; i < n; i++)
+                out[i] = gen.next();
+        };
+        measure<Decoder>("synthetic", uint64_t(o.hours * 3600 * config.rate),
+                         fill, o.repeats, cpu);
+        return 0;
+    }
+    for (; *files; files++) {
+        std::vector<uint8_t> samples;
+        if (!load(*files, o.fmt, samples))
+            return 1;
+        size_t pos = 0;
+        auto fill = [&](uint8_t *out, size_t n) {
+            std::copy_n(samples.begin() + pos, n, out);
+            pos += n;
+        };
+        measure<Decoder>(*files, samples.size(), fill, o.repeats, cpu);
+    }
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [-r 50|100|1000] [-R repeats] [-i ascii|packed] "
+            "[files...]\n"
+            "   or: %s [-r 50|100|1000] [-R repeats] [-d hours] [-n noise]\n"
+            "          [-f fades_per_hour] [-S seed]\n",
+            argv0, argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    options o;
+    parse_utc("2021-11-06T12:00Z", o.config.start);
+    for (int opt; (opt = getopt(argc, argv, "r:R:d:n:f:S:i:")) != -1;) {
+        switch (opt) {
+        case 'r':
+            o.rate = atoi(optarg);
+            break;
+        case 'R':
+            o.repeats = std::max(1, atoi(optarg));
+            break;
+        case 'd':
+            o.hours = atof(optarg);
+            break;
+        case 'n':
+            o.config.flip_probability = atof(optarg);
+            break;
+        case 'f':
+            o.config.fades_per_hour = atof(optarg);
+            break;
+        case 'S':
+            o.config.seed = strtoull(optarg, nullptr, 0);
+            break;
+        case 'i':
+            if (!strcmp(optarg, "ascii"))
+                o.fmt = input_format::ascii;
+            else if (!strcmp(optarg, "packed"))
+                o.fmt = input_format::packed;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    switch (o.rate) {
+    case 50:
+        return run<WWVBDecoder<50>>(o, argv + optind);
+    case 100:
+        return run<WWVBDecoder<100>>(o, argv + optind);
+    case 1000:
+        return run<WWVBDecoder<1000>>(o, argv + optind);
+    }
+    usage(argv[0]);
+}
+#endif
@@ -0,0 +1,162 @@
+// SPDX-FileCopyrightText: 2021 Jeff Epler
+//
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Command-line front end to the synthetic signal generator.  The output can
+// be fed straight to `decoder`.
+
+#ifndef ARDUINO
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "generator.h"
+#include "sink.h"
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s -s start -d duration [options]\n"
+            "  -s start     UTC start, YYYY-MM-DD[THH:MM[:SS]] or @seconds\n"
+            "  -d duration  seconds, or with suffix m, h or d\n"
+            "  -r rate      samples per second (default 50)\n"
+            "  -D min,max   receiver delay range in ms (default 40,80)\n"
+            "  -p ppm       local oscillator error (default 0)\n"
+            "  -n prob      per-sample bit flip probability (default 0)\n"
+            "  -f n         burst fades per hour (default 0)\n"
+            "  -F seconds   average fade length (default 5)\n"
+            "  -u dut1      DUT1 in tenths of a second (default 3)\n"
+            "  -L day       UTC day, YYYY-MM-DD, ending in a leap second\n"
+            "  -S seed      random seed (default 1)\n"
+            "  -P           write packed samples, 8 per byte, instead of _#\n"
+            "  -o output    write to a file instead of stdout\n",
+            argv0);
+    exit(2);
+}
+
+static bool parse_duration(const char *s, double &seconds) {
+    char *end;
+    seconds = strtod(s, &end);
+    switch (*end) {
+    case 'd':
+        seconds *= 24;
+        /* fallthrough */
+    case 'h':
+        seconds *= 60;
+        /* fallthrough */
+    case 'm':
+        seconds *= 60;
+        end++;
+        break;
+    case 's':
+        end++;
+        break;
+    }
+    return end != s && !*end && seconds >= 0;
+}
+
+int main(int argc, char **argv) {
+    wwvb_signal_config config;
+    bool have_start = false, packed = false;
+    double duration = -1;
+    int out_fd = 1;
+
+    for (int opt; (opt = getopt(argc, argv, "s:d:r:D:p:n:f:F:u:L:S:Po:")) !=
+                  -1;) {
+        switch (opt) {
+        case 's':
+            if (!parse_utc(optarg, config.start))
+                usage(argv[0]);
+            have_start = true;
+            break;
+        case 'd':
+            if (!parse_duration(optarg, duration))
+                usage(argv[0]);
+            break;
+        case 'r':
+            config.rate = atoi(optarg);
+            if (config.rate <= 0)
+                usage(argv[0]);
+            break;
+        case 'D':
+            if (sscanf(optarg, "%lf,%lf", &config.delay_min_ms,
+                       &config.delay_max_ms) != 2 ||
+                config.delay_min_ms > config.delay_max_ms)
+                usage(argv[0]);
+            break;
+        case 'p':
+            config.drift_ppm = atof(optarg);
+            break;
+        case 'n':
+            config.flip_probability = atof(optarg);
+            break;
+        case 'f':
+            config.fades_per_hour = atof(optarg);
+            break;
+        case 'F':
+            config.fade_seconds = atof(optarg);
+            break;
+        case 'u':
+            config.dut1 = atoi(optarg);
+            if (config.dut1 < -9 || config.dut1 > 9)
+                usage(argv[0]);
+            break;
+        case 'L':
+            if (!parse_utc(optarg, config.leap_second_day))
+                usage(argv[0]);
+            break;
+        case 'S':
+            config.seed = strtoull(optarg, nullptr, 0);
+            break;
+        case 'P':
+            packed = true;
+            break;
+        case 'o':
+            out_fd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (out_fd < 0) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!have_start || duration < 0 || optind != argc)
+        usage(argv[0]);
+
+    wwvb_signal_generator gen(config);
+    buffered_writer out(out_fd);
+    uint64_t samples = uint64_t(duration * config.rate);
+
+    char line[4096];
+    size_t len = 0;
+    if (packed) {
+        for (uint64_t i = 0; i < samples; i += 8) {
+            unsigned char byte = 0;
+            for (int j = 0; j < 8; j++)
+                byte |= (i + j < samples && gen.next()) << j;
+            line[len++] = byte;
+            if (len == sizeof(line)) {
+                out.write(line, len);
+                len = 0;
+            }
+        }
+    } else {
+        for (uint64_t i = 0; i < samples; i++) {
+            line[len++] = gen.next() ? '_' : '#';
+            if ((i + 1) % config.rate == 0 || len == sizeof(line) - 1) {
+                if ((i + 1) % config.rate == 0)
+                    line[len++] = '\n';
+                out.write(line, len);
+                len = 0;
+            }
+        }
+    }
+    out.write(line, len);
+    out.flush();
+    return out.failed();
+}
+#endif